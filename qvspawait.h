@@ -0,0 +1,227 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPAWAIT_H
+#define QVSPAWAIT_H
+
+#include "qvspsocket.h"
+
+// header only, available when the application is built as C++20
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#  if __has_include(<coroutine>)
+#    include <coroutine>
+#    define QVSP_COROUTINES
+#  endif
+#endif
+
+#ifdef QVSP_COROUTINES
+
+namespace MiVSP
+{
+
+/*!
+ * \brief The QVSPAwaitable class provides awaitable operations on a socket
+ *
+ * \code
+ * QVSPAwaitable io(socket);
+ * if (!co_await io.connect(info))
+ *     co_return;
+ * co_await io.write("hello\n");          // resumed when acknowledged
+ * const QByteArray line = co_await io.readUntil('\n');
+ * \endcode
+ *
+ * The coroutine is resumed directly from the socket handlers processing the
+ * notification or acknowledgement, in the socket's thread. An operation
+ * lives in the coroutine frame and registers with the socket intrusively, so
+ * awaiting does not allocate. Any coroutine type may be used for the caller.
+ * At most one read operation should be pending at a time.
+ */
+class QVSPAwaitable
+{
+public:
+    class Operation : public QVSPSocket::Waiter
+    {
+    private:
+        std::coroutine_handle<> handle;
+
+    protected:
+        explicit Operation(QVSPSocket &socket) : Waiter(socket) {}
+
+        void resume() override { handle.resume(); } // may destroy this
+
+    public:
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            handle = h;
+            wait();
+        }
+    };
+
+    class Connect : public Operation
+    {
+    private:
+        QBluetoothDeviceInfo info;
+
+    protected:
+        bool ready(Reason reason) override
+        {
+            return reason == Reason::Error || socket.isOpen()
+                || socket.state() == QBluetoothSocket::SocketState::UnconnectedState;
+        }
+
+    public:
+        Connect(QVSPSocket &socket, const QBluetoothDeviceInfo &info) : Operation(socket), info(info) {}
+
+        bool await_ready()
+        {
+            if (!socket.isOpen())
+                socket.connectToDevice(info);
+            return socket.isOpen();
+        }
+
+        // false on error, the socket should be closed then
+        bool await_resume() { return socket.isOpen(); }
+    };
+
+    class Read : public Operation
+    {
+    private:
+        qint64 size;
+
+    protected:
+        bool ready(Reason) override { return await_ready(); }
+
+    public:
+        Read(QVSPSocket &socket, qint64 size) : Operation(socket), size(size) {}
+
+        // resumed as the connection closes, while the buffered data is still there
+        bool await_ready()
+        {
+            return socket.bytesAvailable() >= size || !socket.isOpen()
+                || socket.state() == QBluetoothSocket::SocketState::ClosingState;
+        }
+
+        // fewer bytes if the connection is being closed
+        QByteArray await_resume()
+        {
+            return socket.isOpen() ? socket.read(qMin(size, socket.bytesAvailable())) : QByteArray();
+        }
+    };
+
+    class ReadUntil : public Operation
+    {
+    private:
+        char delimiter;
+
+    protected:
+        bool ready(Reason) override { return await_ready(); }
+
+    public:
+        ReadUntil(QVSPSocket &socket, char delimiter) : Operation(socket), delimiter(delimiter) {}
+
+        bool await_ready() { return !socket.isOpen() || indexOf(delimiter) >= 0; }
+
+        // delimiter included, empty if the connection has been closed
+        QByteArray await_resume()
+        {
+            if (!socket.isOpen())
+                return QByteArray();
+            return socket.read(indexOf(delimiter) + 1);
+        }
+    };
+
+    class Write : public Operation
+    {
+    private:
+        QByteArray data;
+        QVSPSocket::Priority priority;
+        qint64 result = -1;
+        qint64 begin = 0; // stream offsets of the data
+        qint64 end = 0;
+
+    protected:
+        bool ready(Reason) override
+        {
+            if (lost(priority, begin, end))
+            {
+                result = -1; // the packet carrying it failed
+                return true;
+            }
+            return acknowledged(priority) >= end || !socket.isOpen();
+        }
+
+    public:
+        Write(QVSPSocket &socket, const QByteArray &data, QVSPSocket::Priority priority)
+            : Operation(socket), data(data), priority(priority) {}
+
+        bool await_ready()
+        {
+            begin = queued(priority);
+            result = socket.write(data, priority);
+            if (result < 0)
+                return true;
+            if (priority == QVSPSocket::Priority::Normal && socket.compression() != QVSPSocket::Compression::None)
+                socket.flush(); // a staged partial block would never be acknowledged
+            end = queued(priority);
+            return ready(Reason::Acknowledged);
+        }
+
+        // bytes written, -1 on error or if the connection has been closed
+        qint64 await_resume() { return socket.isOpen() ? result : -1; }
+    };
+
+private:
+    QVSPSocket &socket;
+
+public:
+    explicit QVSPAwaitable(QVSPSocket &socket) : socket(socket) {}
+
+    // completes when the handshake finished or failed
+    Connect connect(const QBluetoothDeviceInfo &info) { return Connect(socket, info); }
+    // completes when size bytes are available
+    Read read(qint64 size) { return Read(socket, size); }
+    // completes when the delimiter has been received
+    ReadUntil readUntil(char delimiter) { return ReadUntil(socket, delimiter); }
+    // completes when the device acknowledged the last packet of the data
+    Write write(const QByteArray &data, QVSPSocket::Priority priority = QVSPSocket::Priority::Normal)
+    {
+        return Write(socket, data, priority);
+    }
+};
+
+} // namespace
+
+#endif // QVSP_COROUTINES
+
+#endif // QVSPAWAIT_H
@@ -0,0 +1,144 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspbufferpool.h"
+
+namespace MiVSP
+{
+
+/*!
+ * \brief QVSPBufferPool::QVSPBufferPool Creates a memory budget shared by
+ * several sockets
+ * \param capacity total bytes the sockets may buffer, rounded down to blocks
+ * \param blockSize granularity of the budget, at least 64
+ * \param parent parent
+ *
+ * Sockets attached with QVSPSocket::setBufferPool() borrow blocks as received
+ * and written data is buffered and return them as it is drained, so the
+ * memory of a gateway with many sockets follows the data actually buffered
+ * instead of the socket count times the per-socket limits. The pool may be
+ * shared by sockets living in different threads.
+ */
+QVSPBufferPool::QVSPBufferPool(qint64 capacity, int blockSize, QObject* parent)
+    : QObject(parent), _blockSize(qMax(64, blockSize))
+{
+    setCapacity(capacity);
+}
+
+/*!
+ * \brief QVSPBufferPool::acquire Borrows blocks
+ * \param blocks number of blocks
+ * \return false if the capacity would be exceeded, nothing is borrowed then
+ */
+bool QVSPBufferPool::acquire(int blocks)
+{
+    int current = used.loadAcquire();
+    do
+    {
+        if (blocks > capacityBlocks.loadAcquire() - current)
+        {
+            exhausted.storeRelease(1);
+            return false;
+        }
+    }
+    while (!used.testAndSetOrdered(current, current + blocks, current));
+
+    int high = peak.loadAcquire();
+    while (current + blocks > high && !peak.testAndSetOrdered(high, current + blocks, high))
+        ;
+    return true;
+}
+
+/*!
+ * \brief QVSPBufferPool::release Returns borrowed blocks
+ * \param blocks number of blocks
+ *
+ * Emits released() if an acquisition failed before, so that starved sockets
+ * can resume receiving.
+ */
+void QVSPBufferPool::release(int blocks)
+{
+    if (blocks <= 0)
+        return;
+
+    used.fetchAndSubOrdered(blocks);
+    if (exhausted.fetchAndStoreOrdered(0) != 0)
+        emit released();
+}
+
+int QVSPBufferPool::blockSize() const
+{
+    return _blockSize;
+}
+
+qint64 QVSPBufferPool::capacity() const
+{
+    return qint64(capacityBlocks.loadAcquire()) * _blockSize;
+}
+
+/*!
+ * \brief QVSPBufferPool::setCapacity Changes the total budget
+ * \param capacity bytes, rounded down to blocks
+ *
+ * Lowering it below the bytes in use does not take blocks back, further
+ * acquisitions fail until enough has been released.
+ */
+void QVSPBufferPool::setCapacity(qint64 capacity)
+{
+    const int previous = capacityBlocks.fetchAndStoreOrdered(int(qBound(qint64(0), capacity / _blockSize, qint64(INT_MAX))));
+    if (capacityBlocks.loadAcquire() > previous && exhausted.fetchAndStoreOrdered(0) != 0)
+        emit released();
+}
+
+int QVSPBufferPool::blocksAvailable() const
+{
+    return qMax(0, capacityBlocks.loadAcquire() - used.loadAcquire());
+}
+
+qint64 QVSPBufferPool::bytesInUse() const
+{
+    return qint64(used.loadAcquire()) * _blockSize;
+}
+
+qint64 QVSPBufferPool::peakBytesInUse() const
+{
+    return qint64(peak.loadAcquire()) * _blockSize;
+}
+
+void QVSPBufferPool::resetPeak()
+{
+    peak.storeRelease(used.loadAcquire());
+}
+
+} // namespace
@@ -0,0 +1,75 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPBUFFERPOOL_H
+#define QVSPBUFFERPOOL_H
+
+#include "qvspsocket_global.h"
+#include <QAtomicInteger>
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPBufferPool : public QObject
+{
+    Q_OBJECT
+
+private:
+    const int _blockSize;
+    QAtomicInteger<int> capacityBlocks;
+    QAtomicInteger<int> used; // blocks lent out
+    QAtomicInteger<int> peak;
+    QAtomicInteger<int> exhausted; // an acquisition failed since the last release
+
+public:
+    explicit QVSPBufferPool(qint64 capacity, int blockSize = 512, QObject* parent = nullptr);
+
+    bool acquire(int blocks);
+    void release(int blocks);
+
+    int blockSize() const;
+    qint64 capacity() const;
+    void setCapacity(qint64 capacity);
+    int blocksAvailable() const;
+    qint64 bytesInUse() const;
+    qint64 peakBytesInUse() const;
+    void resetPeak();
+
+signals:
+    void released(); // blocks became available after an acquisition failed
+};
+
+} // namespace
+
+#endif // QVSPBUFFERPOOL_H
@@ -0,0 +1,167 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspcapture.h"
+#include <QDateTime>
+#include <QtEndian>
+#include <cstring>
+
+namespace MiVSP
+{
+
+// timestamped record header: 64 bit ms since epoch and 16 bit length, little endian
+static const int RECORD_HEADER_SIZE = 10;
+
+/*!
+ * \brief QVSPCaptureFile::QVSPCaptureFile Creates a capture file
+ * \param path file path, data is appended to an existing file
+ * \param timestamps true to prefix every chunk with a record header
+ * \param growth preallocation step of the file in byte
+ *
+ * Chunks are copied straight into a memory mapped window at the end of the
+ * file, which is preallocated in steps of \a growth byte; a write to the
+ * file system only happens when the window is exhausted. close() truncates
+ * the preallocated tail.
+ *
+ * With timestamps every chunk is stored as a record of the receive time in
+ * ms since epoch (64 bit), the chunk length (16 bit), both little endian,
+ * and the chunk data. After a crash the file ends with a zero filled
+ * preallocated tail, a record of length zero marks the end.
+ */
+QVSPCaptureFile::QVSPCaptureFile(const QString &path, bool timestamps, qint64 growth)
+    : file(path), _timestamps(timestamps), _growth(qMax<qint64>(4096, growth))
+{
+}
+
+QVSPCaptureFile::~QVSPCaptureFile()
+{
+    close();
+}
+
+bool QVSPCaptureFile::open()
+{
+    if (!file.open(QIODevice::ReadWrite))
+        return false;
+
+    _size = file.size();
+    return true;
+}
+
+void QVSPCaptureFile::close()
+{
+    if (!file.isOpen())
+        return;
+
+    if (map != nullptr)
+        file.unmap(map);
+    map = nullptr;
+    mapStart = mapEnd = 0;
+
+    file.resize(_size); // drop the preallocated tail
+    file.close();
+}
+
+bool QVSPCaptureFile::isOpen() const
+{
+    return file.isOpen();
+}
+
+/*!
+ * \brief QVSPCaptureFile::reserve Makes sure the mapped window can take
+ * \a len more byte, moving it to the end of the captured data if not
+ */
+bool QVSPCaptureFile::reserve(qint64 len)
+{
+    if (map != nullptr && _size + len <= mapEnd)
+        return true;
+
+    if (map != nullptr)
+        file.unmap(map);
+    map = nullptr;
+
+    const qint64 window = qMax(_growth, len);
+    if (!file.resize(_size + window))
+        return false;
+    map = file.map(_size, window);
+    if (map == nullptr)
+        return false;
+
+    mapStart = _size;
+    mapEnd = _size + window;
+    return true;
+}
+
+/*!
+ * \brief QVSPCaptureFile::append Appends a chunk of received data
+ * \param data chunk data
+ * \param len chunk length, at most 65535 with timestamps
+ * \return false if the file cannot be extended or mapped
+ *
+ * Empty chunks are ignored, a record of length 0 marks the end of the data.
+ */
+bool QVSPCaptureFile::append(const char *data, int len)
+{
+    const int header = _timestamps ? RECORD_HEADER_SIZE : 0;
+    if (file.isOpen() && len == 0)
+        return true;
+    if (!file.isOpen() || (_timestamps && len > 0xFFFF) || !reserve(header + len))
+        return false;
+
+    uchar *p = map + (_size - mapStart);
+    if (_timestamps)
+    {
+        qToLittleEndian<quint64>(quint64(QDateTime::currentMSecsSinceEpoch()), p);
+        qToLittleEndian<quint16>(quint16(len), p + 8);
+    }
+    memcpy(p + header, data, size_t(len));
+    _size += header + len;
+    return true;
+}
+
+qint64 QVSPCaptureFile::size() const
+{
+    return _size;
+}
+
+bool QVSPCaptureFile::timestamps() const
+{
+    return _timestamps;
+}
+
+QString QVSPCaptureFile::errorString() const
+{
+    return file.errorString();
+}
+
+} // namespace
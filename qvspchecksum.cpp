@@ -0,0 +1,178 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspchecksum.h"
+
+#if defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#  define QVSP_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define QVSP_CRC32C_ARM
+#endif
+
+namespace MiVSP
+{
+
+// CRC-32C (Castagnoli), reflected polynomial
+static const quint32 CRC32C_POLY = 0x82F63B78;
+// CRC-16/CCITT-FALSE polynomial
+static const quint16 CRC16_POLY = 0x1021;
+
+// slice-by-8 lookup tables, table[k][b] is the CRC of byte b followed by k zero bytes
+struct Crc32cTable
+{
+    quint32 table[8][256];
+
+    Crc32cTable()
+    {
+        for (quint32 b = 0; b < 256; ++b)
+        {
+            quint32 crc = b;
+            for (int i = 0; i < 8; ++i)
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            table[0][b] = crc;
+        }
+        for (int k = 1; k < 8; ++k)
+            for (int b = 0; b < 256; ++b)
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+    }
+};
+
+struct Crc16Table
+{
+    quint16 table[8][256];
+
+    Crc16Table()
+    {
+        for (quint32 b = 0; b < 256; ++b)
+        {
+            quint16 crc = quint16(b << 8);
+            for (int i = 0; i < 8; ++i)
+                crc = quint16((crc << 1) ^ ((crc & 0x8000) ? CRC16_POLY : 0));
+            table[0][b] = crc;
+        }
+        for (int k = 1; k < 8; ++k)
+            for (int b = 0; b < 256; ++b)
+                table[k][b] = quint16((table[k - 1][b] << 8) ^ table[0][table[k - 1][b] >> 8]);
+    }
+};
+
+#if !defined(QVSP_CRC32C_SSE42) && !defined(QVSP_CRC32C_ARM)
+static const Crc32cTable CRC32C_TABLE;
+#endif
+static const Crc16Table CRC16_TABLE;
+
+static inline quint32 load32(const uchar *p)
+{
+    return quint32(p[0]) | quint32(p[1]) << 8 | quint32(p[2]) << 16 | quint32(p[3]) << 24;
+}
+
+/*!
+ * \brief crc32c Computes the CRC-32C (Castagnoli) checksum
+ * \param data input data
+ * \param len input length
+ * \param crc checksum of the preceding data, 0 to start a new computation
+ * \return checksum
+ *
+ * Uses the SSE 4.2 or ARMv8 CRC instructions when the library is built for
+ * them, otherwise slice-by-8 lookup tables.
+ */
+quint32 crc32c(const char *data, qint64 len, quint32 crc)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    const uchar *end = p + len;
+    crc = ~crc;
+
+#if defined(QVSP_CRC32C_SSE42) && defined(__x86_64__)
+    quint64 crc64 = crc;
+    for (; end - p >= 8; p += 8)
+        crc64 = _mm_crc32_u64(crc64, quint64(load32(p)) | quint64(load32(p + 4)) << 32);
+    crc = quint32(crc64);
+    for (; p < end; ++p)
+        crc = _mm_crc32_u8(crc, *p);
+#elif defined(QVSP_CRC32C_SSE42)
+    for (; end - p >= 4; p += 4)
+        crc = _mm_crc32_u32(crc, load32(p));
+    for (; p < end; ++p)
+        crc = _mm_crc32_u8(crc, *p);
+#elif defined(QVSP_CRC32C_ARM)
+    for (; end - p >= 8; p += 8)
+        crc = __crc32cd(crc, quint64(load32(p)) | quint64(load32(p + 4)) << 32);
+    for (; p < end; ++p)
+        crc = __crc32cb(crc, *p);
+#else
+    const quint32 (&t)[8][256] = CRC32C_TABLE.table;
+    for (; end - p >= 8; p += 8)
+    {
+        const quint32 lo = crc ^ load32(p);
+        const quint32 hi = load32(p + 4);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for (; p < end; ++p)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+#endif
+
+    return ~crc;
+}
+
+/*!
+ * \brief crc16 Computes the CRC-16/CCITT-FALSE checksum (polynomial 0x1021,
+ * no reflection, no final XOR)
+ * \param data input data
+ * \param len input length
+ * \param crc checksum of the preceding data, 0xFFFF to start a new computation
+ * \return checksum
+ *
+ * Uses slice-by-8 lookup tables.
+ */
+quint16 crc16(const char *data, qint64 len, quint16 crc)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    const uchar *end = p + len;
+    const quint16 (&t)[8][256] = CRC16_TABLE.table;
+
+    for (; end - p >= 8; p += 8)
+    {
+        crc = t[7][(crc >> 8) ^ p[0]] ^ t[6][(crc & 0xFF) ^ p[1]] ^ t[5][p[2]] ^ t[4][p[3]]
+            ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    for (; p < end; ++p)
+        crc = quint16((crc << 8) ^ t[0][(crc >> 8) ^ *p]);
+
+    return crc;
+}
+
+} // namespace
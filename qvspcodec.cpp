@@ -0,0 +1,517 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspcodec.h"
+#include <QtAlgorithms>
+#include <QVarLengthArray>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define QVSP_SCAN_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define QVSP_SCAN_NEON
+#endif
+
+namespace MiVSP
+{
+
+using Result = QVSPCobsCodec::Result;
+
+// SLIP special characters
+static const char SLIP_END = char(0xC0);
+static const char SLIP_ESC = char(0xDB);
+static const char SLIP_ESC_END = char(0xDC);
+static const char SLIP_ESC_ESC = char(0xDD);
+
+/*!
+ * \brief scan Returns the first occurrence of \a a or \a b in [\a p, \a end)
+ * \return pointer to the match or \a end if there is none
+ *
+ * 16 byte blocks are compared with SSE2 or NEON where available, the remainder
+ * falls back to a plain byte loop.
+ */
+static const char *scan(const char *p, const char *end, char a, char b)
+{
+#if defined(QVSP_SCAN_SSE2)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask != 0)
+            return p + qCountTrailingZeroBits(quint32(mask));
+    }
+#elif defined(QVSP_SCAN_NEON)
+    const uint8x16_t va = vdupq_n_u8(quint8(a));
+    const uint8x16_t vb = vdupq_n_u8(quint8(b));
+    for (; end - p >= 16; p += 16)
+    {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+        const uint64x2_t mask = vreinterpretq_u64_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)));
+        if ((vgetq_lane_u64(mask, 0) | vgetq_lane_u64(mask, 1)) != 0)
+            break; // the match is located by the byte loop below
+    }
+#endif
+    for (; p < end; ++p)
+    {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+/*!
+ * \brief QVSPCobsCodec::QVSPCobsCodec Creates a COBS decoder
+ * \param maxFrameSize maximum decoded frame size, larger frames are dropped
+ *
+ * Frames are delimited by a 0x00 byte.
+ */
+QVSPCobsCodec::QVSPCobsCodec(int maxFrameSize)
+    : _maxFrameSize(qMax(0, maxFrameSize))
+{
+}
+
+bool QVSPCobsCodec::append(const char *data, int len)
+{
+    if (frame.size() + len > _maxFrameSize)
+    {
+        frame.clear();
+        discarding = true;
+        return false;
+    }
+    frame.append(data, len);
+    return true;
+}
+
+/*!
+ * \brief QVSPCobsCodec::encode Appends the COBS encoding of a frame to \a out
+ * \param data frame data
+ * \param len frame length
+ * \param out output buffer, the 0x00 delimiter is included
+ */
+void QVSPCobsCodec::encode(const char *data, int len, QByteArray &out)
+{
+    const char *end = data + len;
+    out.reserve(out.size() + len + len / 254 + 2);
+
+    for (;;)
+    {
+        const char *limit = data + qMin<qint64>(254, end - data);
+        const char *zero = scan(data, limit, 0, 0);
+        out.append(char(zero - data + 1)); // code byte
+        out.append(data, int(zero - data));
+        if (zero != limit)
+            data = zero + 1; // the zero is implied by the code byte
+        else if ((data = limit) == end)
+            break;
+    }
+
+    out.append(char(0)); // delimiter
+}
+
+QByteArray QVSPCobsCodec::encode(const QByteArray &data)
+{
+    QByteArray out;
+    encode(data.constData(), data.size(), out);
+    return out;
+}
+
+/*!
+ * \brief QVSPCobsCodec::decode Decodes input until a frame is complete
+ * \param data start of the input, advanced past the consumed bytes
+ * \param end end of the input
+ * \return Frame when a frame has been completed, Error when a malformed or
+ * oversized frame has been dropped, Incomplete when all input is consumed
+ *
+ * Call repeatedly until Incomplete is returned. After an error the decoder
+ * resynchronises on the next delimiter.
+ */
+Result QVSPCobsCodec::decode(const char *&data, const char *end)
+{
+    while (data < end)
+    {
+        if (discarding)
+        {
+            data = scan(data, end, 0, 0);
+            if (data == end)
+                break;
+            ++data; // delimiter
+            reset();
+        }
+        else if (left > 0)
+        {
+            const char *limit = data + qMin<qint64>(left, end - data);
+            const char *zero = scan(data, limit, 0, 0);
+            if (!append(data, int(zero - data)))
+                return Result::Error;
+            left -= int(zero - data);
+            data = zero;
+            if (zero != limit)
+            {
+                // delimiter within a block, the frame has been truncated
+                ++data;
+                reset();
+                return Result::Error;
+            }
+        }
+        else
+        {
+            const quint8 code = quint8(*data++);
+            if (code == 0)
+            {
+                if (!started)
+                    continue; // empty gap between frames
+                started = false;
+                pendingZero = false;
+                return Result::Frame;
+            }
+
+            if (pendingZero && !append("", 1))
+                return Result::Error;
+            started = true;
+            left = code - 1;
+            pendingZero = code != 0xFF;
+        }
+    }
+
+    return Result::Incomplete;
+}
+
+/*!
+ * \brief QVSPCobsCodec::takeFrame Returns the last completed frame
+ */
+QByteArray QVSPCobsCodec::takeFrame()
+{
+    QByteArray res = frame;
+    frame.clear();
+    return res;
+}
+
+/*!
+ * \brief QVSPCobsCodec::reset Discards any partially decoded frame
+ */
+void QVSPCobsCodec::reset()
+{
+    frame.clear();
+    left = 0;
+    pendingZero = false;
+    started = false;
+    discarding = false;
+}
+
+int QVSPCobsCodec::maxFrameSize() const
+{
+    return _maxFrameSize;
+}
+
+void QVSPCobsCodec::setMaxFrameSize(int maxFrameSize)
+{
+    _maxFrameSize = qMax(0, maxFrameSize);
+}
+
+/*!
+ * \brief QVSPSlipCodec::QVSPSlipCodec Creates a SLIP decoder
+ * \param maxFrameSize maximum decoded frame size, larger frames are dropped
+ *
+ * Frames are terminated by END (0xC0), empty frames are ignored.
+ */
+QVSPSlipCodec::QVSPSlipCodec(int maxFrameSize)
+    : _maxFrameSize(qMax(0, maxFrameSize))
+{
+}
+
+bool QVSPSlipCodec::append(const char *data, int len)
+{
+    if (frame.size() + len > _maxFrameSize)
+    {
+        frame.clear();
+        discarding = true;
+        return false;
+    }
+    frame.append(data, len);
+    return true;
+}
+
+/*!
+ * \brief QVSPSlipCodec::encode Appends the SLIP encoding of a frame to \a out
+ * \param data frame data
+ * \param len frame length
+ * \param out output buffer, the END terminator is included
+ */
+void QVSPSlipCodec::encode(const char *data, int len, QByteArray &out)
+{
+    const char *end = data + len;
+    out.reserve(out.size() + len + len / 64 + 2);
+
+    for (;;)
+    {
+        const char *special = scan(data, end, SLIP_END, SLIP_ESC);
+        out.append(data, int(special - data));
+        if (special == end)
+            break;
+        out.append(SLIP_ESC);
+        out.append(*special == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC);
+        data = special + 1;
+    }
+
+    out.append(SLIP_END);
+}
+
+QByteArray QVSPSlipCodec::encode(const QByteArray &data)
+{
+    QByteArray out;
+    encode(data.constData(), data.size(), out);
+    return out;
+}
+
+/*!
+ * \brief QVSPSlipCodec::decode Decodes input until a frame is complete
+ * \param data start of the input, advanced past the consumed bytes
+ * \param end end of the input
+ * \return Frame when a frame has been completed, Error when a malformed or
+ * oversized frame has been dropped, Incomplete when all input is consumed
+ *
+ * Call repeatedly until Incomplete is returned. After an error the decoder
+ * resynchronises on the next END.
+ */
+Result QVSPSlipCodec::decode(const char *&data, const char *end)
+{
+    while (data < end)
+    {
+        if (escaped)
+        {
+            const char c = *data++;
+            escaped = false;
+            if (c != SLIP_ESC_END && c != SLIP_ESC_ESC)
+            {
+                // invalid escape sequence
+                frame.clear();
+                discarding = c != SLIP_END;
+                return Result::Error;
+            }
+            if (!append(c == SLIP_ESC_END ? &SLIP_END : &SLIP_ESC, 1))
+                return Result::Error;
+            continue;
+        }
+
+        const char *special = scan(data, end, SLIP_END, SLIP_ESC);
+        if (!discarding && !append(data, int(special - data)))
+            return Result::Error;
+        data = special;
+        if (data == end)
+            break;
+
+        if (*data++ == SLIP_ESC)
+            escaped = !discarding;
+        else if (discarding)
+            reset();
+        else if (!frame.isEmpty())
+            return Result::Frame;
+    }
+
+    return Result::Incomplete;
+}
+
+/*!
+ * \brief QVSPSlipCodec::takeFrame Returns the last completed frame
+ */
+QByteArray QVSPSlipCodec::takeFrame()
+{
+    QByteArray res = frame;
+    frame.clear();
+    return res;
+}
+
+/*!
+ * \brief QVSPSlipCodec::reset Discards any partially decoded frame
+ */
+void QVSPSlipCodec::reset()
+{
+    frame.clear();
+    escaped = false;
+    discarding = false;
+}
+
+int QVSPSlipCodec::maxFrameSize() const
+{
+    return _maxFrameSize;
+}
+
+void QVSPSlipCodec::setMaxFrameSize(int maxFrameSize)
+{
+    _maxFrameSize = qMax(0, maxFrameSize);
+}
+
+static const int HS_WINDOW = 1 << QVSPHeatshrinkCodec::WINDOW_BITS;
+static const int HS_MAX_MATCH = 1 << QVSPHeatshrinkCodec::LOOKAHEAD_BITS;
+static const int HS_MIN_MATCH = 2; // a back-reference of 13 bit beats 2 literals of 9 bit
+static const int HS_HASH_BITS = 10;
+static const int HS_MAX_CHAIN = 16; // candidates examined per position
+
+static inline int hsHash(const uchar *p)
+{
+    return int(((quint32(p[0]) << 8 | p[1]) * 2654435761u) >> (32 - HS_HASH_BITS));
+}
+
+/*!
+ * \brief QVSPHeatshrinkCodec::compress Appends the compressed form of a block
+ * to \a out
+ * \param data block data
+ * \param len block length
+ * \param out output buffer
+ *
+ * Produces the heatshrink bit stream (LZSS, MSB first: tag 1 + 8 bit literal
+ * or tag 0 + offset - 1 + length - 1) with WINDOW_BITS and LOOKAHEAD_BITS, so
+ * that the block can be expanded by a heatshrink decoder on a small embedded
+ * peer. Every block starts with an empty window. Matches are searched through
+ * hash chains of byte pairs.
+ */
+void QVSPHeatshrinkCodec::compress(const char *data, int len, QByteArray &out)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    QVarLengthArray<int, 1 << HS_HASH_BITS> head(1 << HS_HASH_BITS);
+    std::fill(head.begin(), head.end(), -1);
+    QVarLengthArray<int, 512> prev(len);
+
+    out.reserve(out.size() + len + len / 8 + 1);
+    quint32 acc = 0;
+    int bits = 0;
+    auto put = [&](quint32 value, int n) {
+        acc = acc << n | value;
+        for (bits += n; bits >= 8; )
+            out.append(char(acc >> (bits -= 8)));
+        acc &= (1u << bits) - 1;
+    };
+
+    for (int i = 0; i < len; )
+    {
+        int best = 0;
+        int offset = 0;
+        if (len - i >= HS_MIN_MATCH)
+        {
+            const int maxLen = qMin(HS_MAX_MATCH, len - i);
+            int candidate = head[hsHash(p + i)];
+            for (int chain = 0; candidate >= 0 && i - candidate <= HS_WINDOW && chain < HS_MAX_CHAIN; ++chain)
+            {
+                int n = 0;
+                while (n < maxLen && p[candidate + n] == p[i + n])
+                    ++n;
+                if (n > best)
+                {
+                    best = n;
+                    offset = i - candidate;
+                    if (n == maxLen)
+                        break;
+                }
+                candidate = prev[candidate];
+            }
+        }
+
+        int step = 1;
+        if (best >= HS_MIN_MATCH)
+        {
+            put(0, 1);
+            put(quint32(offset - 1), WINDOW_BITS);
+            put(quint32(best - 1), LOOKAHEAD_BITS);
+            step = best;
+        }
+        else
+        {
+            put(0x100 | p[i], 9);
+        }
+
+        for (const int end = i + step; i < end; ++i)
+        {
+            if (len - i >= 2)
+            {
+                const int h = hsHash(p + i);
+                prev[i] = head[h];
+                head[h] = i;
+            }
+        }
+    }
+
+    if (bits > 0)
+        out.append(char(acc << (8 - bits))); // pad with zero bits
+}
+
+/*!
+ * \brief QVSPHeatshrinkCodec::decompress Appends the expansion of a block
+ * compressed by compress() to \a out
+ * \param data compressed block
+ * \param len compressed length
+ * \param out output buffer
+ * \param maxSize maximum expanded size
+ * \return false if the block is malformed or expands beyond \a maxSize
+ */
+bool QVSPHeatshrinkCodec::decompress(const char *data, int len, QByteArray &out, int maxSize)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    const qint64 total = qint64(len) * 8;
+    qint64 pos = 0;
+    auto get = [&](int n) {
+        quint32 value = 0;
+        for (; n > 0; --n, ++pos)
+            value = value << 1 | ((p[pos >> 3] >> (7 - (pos & 7))) & 1);
+        return value;
+    };
+
+    const int base = out.size();
+    while (total - pos >= 9) // fewer bits are padding
+    {
+        if (get(1))
+        {
+            if (out.size() - base >= maxSize)
+                return false;
+            out.append(char(get(8)));
+            continue;
+        }
+
+        if (total - pos < WINDOW_BITS + LOOKAHEAD_BITS)
+            return false;
+        const int offset = int(get(WINDOW_BITS)) + 1;
+        const int count = int(get(LOOKAHEAD_BITS)) + 1;
+        if (offset > out.size() - base || out.size() - base + count > maxSize)
+            return false;
+        for (int i = 0; i < count; ++i)
+            out.append(out.at(out.size() - offset)); // may overlap
+    }
+
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,118 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPCODEC_H
+#define QVSPCODEC_H
+
+#include "qvspsocket_global.h"
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPCobsCodec
+{
+public:
+    enum class Result
+    {
+        Incomplete, // all input consumed, frame not finished yet
+        Frame,      // a frame is complete, retrieve it with takeFrame()
+        Error       // malformed or oversized frame dropped
+    };
+
+private:
+    int _maxFrameSize;
+
+    QByteArray frame;
+    int left = 0; // data bytes left in the current block
+    bool pendingZero = false; // a zero is implied before the next block
+    bool started = false;
+    bool discarding = false; // skipping until the next delimiter
+
+    bool append(const char *data, int len);
+
+public:
+    explicit QVSPCobsCodec(int maxFrameSize = 4096);
+
+    static void encode(const char *data, int len, QByteArray &out);
+    static QByteArray encode(const QByteArray &data);
+
+    Result decode(const char *&data, const char *end);
+    QByteArray takeFrame();
+    void reset();
+
+    int maxFrameSize() const;
+    void setMaxFrameSize(int maxFrameSize);
+};
+
+class QVSPSOCKETSHARED_EXPORT QVSPSlipCodec
+{
+public:
+    using Result = QVSPCobsCodec::Result;
+
+private:
+    int _maxFrameSize;
+
+    QByteArray frame;
+    bool escaped = false; // the previous byte was ESC
+    bool discarding = false; // skipping until the next END
+
+    bool append(const char *data, int len);
+
+public:
+    explicit QVSPSlipCodec(int maxFrameSize = 4096);
+
+    static void encode(const char *data, int len, QByteArray &out);
+    static QByteArray encode(const QByteArray &data);
+
+    Result decode(const char *&data, const char *end);
+    QByteArray takeFrame();
+    void reset();
+
+    int maxFrameSize() const;
+    void setMaxFrameSize(int maxFrameSize);
+};
+
+class QVSPSOCKETSHARED_EXPORT QVSPHeatshrinkCodec
+{
+public:
+    static const int WINDOW_BITS = 8; // 256 byte window
+    static const int LOOKAHEAD_BITS = 4; // 16 byte matches
+
+    static void compress(const char *data, int len, QByteArray &out);
+    static bool decompress(const char *data, int len, QByteArray &out, int maxSize);
+};
+
+} // namespace
+
+#endif // QVSPCODEC_H
@@ -0,0 +1,142 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvsphistogram.h"
+#include <QtAlgorithms>
+#include <cstring>
+#include <limits>
+
+namespace MiVSP
+{
+
+static const int HALF_BUCKET = 1 << (QVSPHistogram::SUB_BUCKET_BITS - 1);
+
+/*!
+ * \brief QVSPHistogram::QVSPHistogram Creates an empty histogram
+ *
+ * Values are counted in log-linear buckets like in HdrHistogram: values below
+ * 2^SUB_BUCKET_BITS are exact, above each power of two is split into
+ * 2^(SUB_BUCKET_BITS - 1) buckets, so any non-negative 64 bit value is
+ * recorded with a relative error below 1 / 2^(SUB_BUCKET_BITS - 1). Recording
+ * is a bit scan, a shift and an increment.
+ */
+QVSPHistogram::QVSPHistogram()
+{
+    reset();
+}
+
+int QVSPHistogram::index(quint64 value)
+{
+    const int msb = 63 - int(qCountLeadingZeroBits(value | 1));
+    const int shift = qMax(0, msb - (SUB_BUCKET_BITS - 1));
+    return shift * HALF_BUCKET + int(value >> shift);
+}
+
+qint64 QVSPHistogram::highestEquivalent(int index)
+{
+    if (index < 2 * HALF_BUCKET)
+        return index;
+    const int shift = index / HALF_BUCKET - 1;
+    const quint64 sub = quint64(index - shift * HALF_BUCKET);
+    return qint64(((sub + 1) << shift) - 1);
+}
+
+/*!
+ * \brief QVSPHistogram::record Records a value
+ * \param value value, negative values are recorded as 0
+ */
+void QVSPHistogram::record(qint64 value)
+{
+    value = qMax<qint64>(0, value);
+    ++counts[index(quint64(value))];
+    ++_count;
+    _min = qMin(_min, value);
+    _max = qMax(_max, value);
+    sum += double(value);
+}
+
+void QVSPHistogram::reset()
+{
+    memset(counts, 0, sizeof(counts));
+    _count = 0;
+    _min = std::numeric_limits<qint64>::max();
+    _max = 0;
+    sum = 0;
+}
+
+quint64 QVSPHistogram::count() const
+{
+    return _count;
+}
+
+qint64 QVSPHistogram::min() const
+{
+    return _count == 0 ? 0 : _min;
+}
+
+qint64 QVSPHistogram::max() const
+{
+    return _max;
+}
+
+double QVSPHistogram::mean() const
+{
+    return _count == 0 ? 0 : sum / double(_count);
+}
+
+/*!
+ * \brief QVSPHistogram::percentile Returns the value below which a percentage
+ * of the recorded values lie
+ * \param percentile 0 .. 100, e.g. 99.9
+ * \return highest value equivalent to the bucket of the percentile, capped by
+ * the maximum; 0 if empty
+ */
+qint64 QVSPHistogram::percentile(double percentile) const
+{
+    if (_count == 0)
+        return 0;
+
+    const double p = qBound(0.0, percentile, 100.0);
+    const quint64 rank = qMax<quint64>(1, quint64(p / 100.0 * double(_count) + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return qMin(highestEquivalent(i), _max);
+    }
+    return _max;
+}
+
+} // namespace
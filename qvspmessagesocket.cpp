@@ -0,0 +1,494 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspmessagesocket.h"
+#include "qvspchecksum.h"
+#include <QVarLengthArray>
+#include <climits>
+#include <utility>
+
+namespace MiVSP
+{
+
+/*!
+ * \brief putInt Stores the lowest \a size bytes of \a value in \a byteOrder
+ */
+static void putInt(char *out, quint32 value, int size, QSysInfo::Endian byteOrder)
+{
+    for (int i = 0; i < size; ++i)
+    {
+        const int shift = byteOrder == QSysInfo::BigEndian ? 8 * (size - 1 - i) : 8 * i;
+        out[i] = char(value >> shift);
+    }
+}
+
+/*!
+ * \brief getInt Loads a \a size byte integer stored in \a byteOrder
+ */
+static quint32 getInt(const char *in, int size, QSysInfo::Endian byteOrder)
+{
+    quint32 value = 0;
+    for (int i = 0; i < size; ++i)
+    {
+        const int shift = byteOrder == QSysInfo::BigEndian ? 8 * (size - 1 - i) : 8 * i;
+        value |= quint32(quint8(in[i])) << shift;
+    }
+    return value;
+}
+
+/*!
+ * \brief QVSPMessageSocket::QVSPMessageSocket Creates a new message socket with
+ * a 2 byte big endian length prefix and a maximum message size of 4096 byte
+ * \param parent parent
+ */
+QVSPMessageSocket::QVSPMessageSocket(QObject* parent)
+    : QVSPSocket(parent)
+{
+}
+
+/*!
+ * \brief QVSPMessageSocket::QVSPMessageSocket Creates a new message socket with
+ * a custom framing
+ * \param prefixSize length prefix size in bytes (1, 2 or 4)
+ * \param byteOrder byte order of the length prefix
+ * \param maxMessageSize maximum payload size of a message
+ * \param parent parent
+ */
+QVSPMessageSocket::QVSPMessageSocket(int prefixSize, QSysInfo::Endian byteOrder, int maxMessageSize, QObject* parent)
+    : QVSPSocket(parent), _byteOrder(byteOrder)
+{
+    setPrefixSize(prefixSize);
+    setMaxMessageSize(maxMessageSize);
+}
+
+int QVSPMessageSocket::checksumSize() const
+{
+    switch (_checksum)
+    {
+    case Checksum::Crc16:
+        return 2;
+    case Checksum::Crc32C:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+void QVSPMessageSocket::resetReassembly()
+{
+    prefixReceived = 0;
+    prefixValue = 0;
+    remaining = -1;
+    discarding = false;
+    partial.clear();
+    cobs.reset();
+    slip.reset();
+    cobs.setMaxFrameSize(_maxMessageSize + checksumSize());
+    slip.setMaxFrameSize(_maxMessageSize + checksumSize());
+}
+
+/*!
+ * \brief QVSPMessageSocket::frameReceived Verifies the checksum of a received
+ * frame and emits messageReceived()
+ * \param frame message payload followed by the checksum, if any
+ */
+void QVSPMessageSocket::frameReceived(QByteArray frame)
+{
+    ++counters.received;
+
+    const int n = checksumSize();
+    if (n > 0)
+    {
+        const int len = frame.size() - n;
+        const quint32 crc = _checksum == Checksum::Crc16 ? crc16(frame.constData(), qMax(0, len))
+                                                         : crc32c(frame.constData(), qMax(0, len));
+        if (len < 0 || getInt(frame.constData() + len, n, _byteOrder) != crc)
+        {
+            ++counters.checksumErrors;
+            frameFailed(FrameError::ChecksumMismatch, tr("Incoming message checksum mismatch, message dropped"));
+            return;
+        }
+        frame.chop(n);
+    }
+
+    processMessage(frame);
+}
+
+/*!
+ * \brief QVSPMessageSocket::processMessage Handles a received and verified
+ * message
+ * \param message message payload
+ *
+ * The default implementation emits messageReceived(). Subclasses may override
+ * it to interpret the messages as frames of a higher level protocol.
+ */
+void QVSPMessageSocket::processMessage(const QByteArray &message)
+{
+    emit messageReceived(message);
+}
+
+/*!
+ * \brief QVSPMessageSocket::frameFailed Reports a dropped frame through
+ * frameError() and error()
+ */
+void QVSPMessageSocket::frameFailed(FrameError error, const QString &errorString)
+{
+    emit frameError(error);
+    setError(QLowEnergyService::ServiceError::OperationError, errorString);
+}
+
+/*!
+ * \brief QVSPMessageSocket::dataReceived Reassembles messages from an incoming
+ * TX FIFO packet
+ * \param data packet payload
+ */
+void QVSPMessageSocket::dataReceived(const QByteArray &data)
+{
+    switch (_framing)
+    {
+    case Framing::LengthPrefix:
+        decodeLengthPrefix(data);
+        break;
+    case Framing::Cobs:
+        decode(cobs, data, "COBS");
+        break;
+    case Framing::Slip:
+        decode(slip, data, "SLIP");
+        break;
+    }
+}
+
+/*!
+ * \brief QVSPMessageSocket::decodeLengthPrefix Reassembles length-prefixed
+ * messages
+ * \param data packet payload
+ *
+ * Messages contained completely in \a data are emitted without copying when
+ * they cover the whole packet. Only messages spanning several packets are
+ * collected in an internal buffer.
+ */
+void QVSPMessageSocket::decodeLengthPrefix(const QByteArray &data)
+{
+    const char *p = data.constData();
+    const int size = data.size();
+    int pos = 0;
+
+    while (pos < size)
+    {
+        if (remaining < 0)
+        {
+            // length prefix
+            const quint8 byte = quint8(p[pos++]);
+            if (_byteOrder == QSysInfo::BigEndian)
+                prefixValue = (prefixValue << 8) | byte;
+            else
+                prefixValue |= quint32(byte) << (8 * prefixReceived);
+            if (++prefixReceived < _prefixSize)
+                continue;
+
+            remaining = prefixValue;
+            prefixReceived = 0;
+            prefixValue = 0;
+
+            discarding = remaining > _maxMessageSize + checksumSize();
+            if (discarding)
+            {
+                ++counters.received;
+                ++counters.oversized;
+                frameFailed(FrameError::Oversized,
+                            tr("Incoming message too large (%1 byte, max. size %2), message dropped").arg(remaining).arg(_maxMessageSize));
+            }
+            else if (remaining == 0)
+            {
+                // an empty message is complete with its prefix, even when
+                // the prefix ends the packet
+                remaining = -1;
+                frameReceived(QByteArray());
+                continue;
+            }
+        }
+
+        const int n = int(qMin(remaining, qint64(size - pos)));
+        if (!discarding) // the payload of an oversized message is skipped
+        {
+            if (partial.isEmpty() && n == remaining)
+                // the message is contained in this packet
+                frameReceived(n == size ? data : data.mid(pos, n));
+            else
+            {
+                partial.append(p + pos, n);
+                if (n == remaining)
+                {
+                    frameReceived(std::move(partial));
+                    partial.clear();
+                }
+            }
+        }
+
+        pos += n;
+        remaining -= n;
+        if (remaining == 0)
+        {
+            remaining = -1;
+            discarding = false;
+        }
+    }
+}
+
+/*!
+ * \brief QVSPMessageSocket::decode Feeds a packet into a COBS or SLIP decoder
+ * \param codec decoder
+ * \param data packet payload
+ * \param name framing name used in error messages
+ */
+template<typename Codec>
+void QVSPMessageSocket::decode(Codec &codec, const QByteArray &data, const char *name)
+{
+    const char *p = data.constData();
+    const char *end = p + data.size();
+
+    for (;;)
+    {
+        switch (codec.decode(p, end))
+        {
+        case QVSPCobsCodec::Result::Incomplete:
+            return;
+        case QVSPCobsCodec::Result::Frame:
+            frameReceived(codec.takeFrame());
+            break;
+        case QVSPCobsCodec::Result::Error:
+            ++counters.received;
+            ++counters.malformed;
+            frameFailed(FrameError::Malformed,
+                        tr("Invalid or too large %1 frame (max. size %2), message dropped").arg(QLatin1String(name)).arg(_maxMessageSize));
+            break;
+        }
+    }
+}
+
+/*!
+ * \brief QVSPMessageSocket::close Closes the connection and discards any
+ * partially received message
+ */
+void QVSPMessageSocket::close()
+{
+    QVSPSocket::close();
+    resetReassembly();
+}
+
+QVSPMessageSocket::Framing QVSPMessageSocket::framing() const
+{
+    return _framing;
+}
+
+/*!
+ * \brief QVSPMessageSocket::setFraming Selects how messages are delimited on
+ * the byte stream
+ * \param framing length prefix, COBS (0x00 delimited) or SLIP (RFC 1055)
+ *
+ * The framing should be chosen before connecting, changing it discards any
+ * partially received message.
+ */
+void QVSPMessageSocket::setFraming(Framing framing)
+{
+    _framing = framing;
+    resetReassembly();
+}
+
+int QVSPMessageSocket::prefixSize() const
+{
+    return _prefixSize;
+}
+
+/*!
+ * \brief QVSPMessageSocket::setPrefixSize Sets the size of the length prefix
+ * \param prefixSize 1, 2 or 4 byte; other values are ignored
+ */
+void QVSPMessageSocket::setPrefixSize(int prefixSize)
+{
+    if (prefixSize == 1 || prefixSize == 2 || prefixSize == 4)
+        _prefixSize = prefixSize;
+}
+
+QSysInfo::Endian QVSPMessageSocket::byteOrder() const
+{
+    return _byteOrder;
+}
+
+/*!
+ * \brief QVSPMessageSocket::setByteOrder Sets the byte order of the length
+ * prefix and of the checksum
+ */
+void QVSPMessageSocket::setByteOrder(QSysInfo::Endian byteOrder)
+{
+    _byteOrder = byteOrder;
+}
+
+int QVSPMessageSocket::maxMessageSize() const
+{
+    return _maxMessageSize;
+}
+
+/*!
+ * \brief QVSPMessageSocket::setMaxMessageSize Sets the maximum payload size of
+ * a message in both directions
+ * \param maxMessageSize maximum size, 0 .. INT_MAX
+ *
+ * Incoming messages exceeding it are dropped and reported through error().
+ */
+void QVSPMessageSocket::setMaxMessageSize(int maxMessageSize)
+{
+    _maxMessageSize = qBound(0, maxMessageSize, INT_MAX - 4);
+    resetReassembly();
+}
+
+QVSPMessageSocket::Checksum QVSPMessageSocket::checksum() const
+{
+    return _checksum;
+}
+
+/*!
+ * \brief QVSPMessageSocket::setChecksum Enables a checksum appended to every
+ * message
+ * \param checksum CRC-16/CCITT-FALSE, CRC-32C or none
+ *
+ * Incoming messages with a wrong checksum are dropped and reported through
+ * frameError(). Both sides have to agree on the checksum, which is sent in
+ * byteOrder() and covered by the length prefix.
+ */
+void QVSPMessageSocket::setChecksum(Checksum checksum)
+{
+    _checksum = checksum;
+    resetReassembly();
+}
+
+/*!
+ * \brief QVSPMessageSocket::frameCounters Returns the received frame counters
+ */
+QVSPMessageSocket::FrameCounters QVSPMessageSocket::frameCounters() const
+{
+    return counters;
+}
+
+void QVSPMessageSocket::resetFrameCounters()
+{
+    counters = FrameCounters();
+}
+
+/*!
+ * \brief QVSPMessageSocket::writeMessage Writes a framed message
+ * \param message message payload
+ * \return true if the message has been queued
+ *
+ * With length prefix framing the prefix, the payload and the checksum are
+ * queued separately, so that no concatenated copy of the message is created.
+ * COBS and SLIP framing encode the payload once into the queued buffer.
+ */
+bool QVSPMessageSocket::writeMessage(const QByteArray &message)
+{
+    return writeFrame({ message });
+}
+
+/*!
+ * \brief QVSPMessageSocket::writeFrame Writes several parts as one framed
+ * message
+ * \param parts message parts, e.g. a protocol header and a payload
+ * \param priority priority class, messages of a higher class overtake queued
+ * ones between message boundaries
+ * \return true if the message has been queued
+ *
+ * SLIP framing cannot carry empty messages without a checksum, they fail.
+ */
+bool QVSPMessageSocket::writeFrame(std::initializer_list<QByteArray> parts, Priority priority)
+{
+    int size = 0;
+    for (const QByteArray &part: parts)
+        size += part.size();
+
+    const int n = checksumSize();
+    const quint32 len = quint32(size + n);
+    if (size > _maxMessageSize
+            || (_framing == Framing::LengthPrefix && _prefixSize < 4 && len >> (8 * _prefixSize) != 0))
+    {
+        setError(QLowEnergyService::ServiceError::OperationError,
+                 tr("Outgoing message too large (%1 byte, max. size %2), write failed").arg(size).arg(_maxMessageSize));
+        return false;
+    }
+    if (_framing == Framing::Slip && len == 0)
+    {
+        // SLIP decoders treat back to back END bytes as line noise
+        setError(QLowEnergyService::ServiceError::OperationError,
+                 tr("Empty messages cannot be framed with SLIP, write failed"));
+        return false;
+    }
+
+    char crc[4] = {};
+    if (n > 0)
+    {
+        quint32 value = _checksum == Checksum::Crc16 ? 0xFFFF : 0;
+        for (const QByteArray &part: parts)
+            value = _checksum == Checksum::Crc16 ? crc16(part.constData(), part.size(), quint16(value))
+                                                 : crc32c(part.constData(), part.size(), value);
+        putInt(crc, value, n, _byteOrder);
+    }
+
+    if (_framing != Framing::LengthPrefix)
+    {
+        QByteArray framed;
+        framed.reserve(size + n);
+        for (const QByteArray &part: parts)
+            framed.append(part);
+        framed.append(crc, n);
+
+        QByteArray encoded;
+        if (_framing == Framing::Cobs)
+            QVSPCobsCodec::encode(framed.constData(), framed.size(), encoded);
+        else
+            QVSPSlipCodec::encode(framed.constData(), framed.size(), encoded);
+        return writeSegments({ encoded }, priority) >= 0;
+    }
+
+    char prefix[4];
+    putInt(prefix, len, _prefixSize, _byteOrder);
+
+    QVarLengthArray<QByteArray, 4> segments;
+    segments.append(QByteArray::fromRawData(prefix, _prefixSize));
+    for (const QByteArray &part: parts)
+        segments.append(part);
+    segments.append(QByteArray::fromRawData(crc, n));
+
+    return writeSegments(segments.constData(), segments.size(), priority) >= 0;
+}
+
+} // namespace
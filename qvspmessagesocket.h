@@ -0,0 +1,141 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPMESSAGESOCKET_H
+#define QVSPMESSAGESOCKET_H
+
+#include "qvspsocket.h"
+#include "qvspcodec.h"
+#include <QSysInfo>
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPMessageSocket : public QVSPSocket
+{
+    Q_OBJECT
+
+public:
+    enum class Framing
+    {
+        LengthPrefix,
+        Cobs,
+        Slip
+    };
+    Q_ENUM(Framing)
+
+    enum class Checksum
+    {
+        None,
+        Crc16,  // CRC-16/CCITT-FALSE
+        Crc32C  // CRC-32C (Castagnoli)
+    };
+    Q_ENUM(Checksum)
+
+    enum class FrameError
+    {
+        Oversized,
+        Malformed,
+        ChecksumMismatch
+    };
+    Q_ENUM(FrameError)
+
+    struct FrameCounters
+    {
+        quint64 received = 0; // frames received, including invalid ones
+        quint64 oversized = 0;
+        quint64 malformed = 0;
+        quint64 checksumErrors = 0;
+    };
+
+private:
+    Framing _framing = Framing::LengthPrefix;
+    int _prefixSize = 2; // length prefix size in bytes (1, 2 or 4)
+    QSysInfo::Endian _byteOrder = QSysInfo::BigEndian;
+    int _maxMessageSize = 4096;
+    Checksum _checksum = Checksum::None;
+    FrameCounters counters;
+
+    // reassembly state
+    int prefixReceived = 0; // length prefix bytes received so far
+    quint32 prefixValue = 0;
+    qint64 remaining = -1; // message bytes still missing, -1 while reading the prefix
+    bool discarding = false; // skipping an oversized message
+    QByteArray partial; // message spanning several notifications
+    QVSPCobsCodec cobs;
+    QVSPSlipCodec slip;
+
+    int checksumSize() const;
+    void resetReassembly();
+    void frameReceived(QByteArray frame);
+    void frameFailed(FrameError error, const QString &errorString);
+    void decodeLengthPrefix(const QByteArray &data);
+    template<typename Codec> void decode(Codec &codec, const QByteArray &data, const char *name);
+
+protected:
+    void dataReceived(const QByteArray &data) override;
+    virtual void processMessage(const QByteArray &message);
+    bool writeFrame(std::initializer_list<QByteArray> parts, Priority priority = Priority::Normal);
+
+public:
+    explicit QVSPMessageSocket(QObject* parent = nullptr);
+    explicit QVSPMessageSocket(int prefixSize, QSysInfo::Endian byteOrder = QSysInfo::BigEndian,
+                               int maxMessageSize = 4096, QObject* parent = nullptr);
+
+    void close() override;
+
+    Framing framing() const;
+    void setFraming(Framing framing);
+    int prefixSize() const;
+    void setPrefixSize(int prefixSize);
+    QSysInfo::Endian byteOrder() const;
+    void setByteOrder(QSysInfo::Endian byteOrder);
+    int maxMessageSize() const;
+    void setMaxMessageSize(int maxMessageSize);
+    Checksum checksum() const;
+    void setChecksum(Checksum checksum);
+
+    FrameCounters frameCounters() const;
+    void resetFrameCounters();
+
+    virtual bool writeMessage(const QByteArray &message);
+
+signals:
+    void messageReceived(const QByteArray &message);
+    void frameError(QVSPMessageSocket::FrameError error);
+};
+
+} // namespace
+
+#endif // QVSPMESSAGESOCKET_H
@@ -0,0 +1,324 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspmultiplexsocket.h"
+#include <cstring>
+
+namespace MiVSP
+{
+
+// the high bit of the channel byte marks flow control frames
+static const quint8 CONTROL_FLAG = 0x80;
+static const quint8 MAX_CHANNEL_ID = 0x7F;
+static const char FLOW_PAUSE = 0x00;
+static const char FLOW_RESUME = 0x01;
+
+QVSPChannel::QVSPChannel(QVSPMultiplexSocket *mux, quint8 id, int weight, int maxBufferSize)
+    : QIODevice(mux), mux(mux), _id(id), _weight(qMax(1, weight)), _maxBufferSize(qMax(1, maxBufferSize))
+{
+    QIODevice::open(OpenModeFlag::ReadWrite | OpenModeFlag::Unbuffered);
+}
+
+qint64 QVSPChannel::readData(char *data, qint64 maxlen)
+{
+    const int n = int(qMin(maxlen, qint64(readBuffer.size())));
+    memcpy(data, readBuffer.constData(), size_t(n));
+    readBuffer.remove(0, n);
+
+    if (localPaused && readBuffer.size() <= _maxBufferSize / 4)
+    {
+        // drained, the peer may send again
+        localPaused = false;
+        mux->sendFlowControl(_id, true);
+    }
+
+    return n;
+}
+
+qint64 QVSPChannel::writeData(const char *data, qint64 len)
+{
+    if (!mux->isOpen())
+    {
+        this->setErrorString(tr("Cannot write while not connected"));
+        return -1;
+    }
+
+    if (qint64(writeBuffer.size()) + len > _maxBufferSize)
+    {
+        this->setErrorString(tr("Channel %1 write buffer overflow (max. size %2), write failed").arg(_id).arg(_maxBufferSize));
+        return -1;
+    }
+
+    if (writeBuffer.isEmpty())
+        pass = qMax(pass, mux->virtualTime); // an idle channel does not accumulate credit
+    writeBuffer.append(data, int(len));
+    mux->schedule();
+    return len;
+}
+
+bool QVSPChannel::isSequential() const
+{
+    return true;
+}
+
+qint64 QVSPChannel::bytesAvailable() const
+{
+    return QIODevice::bytesAvailable() + readBuffer.size();
+}
+
+qint64 QVSPChannel::bytesToWrite() const
+{
+    return writeBuffer.size();
+}
+
+bool QVSPChannel::canReadLine() const
+{
+    return QIODevice::canReadLine() || readBuffer.contains('\n');
+}
+
+quint8 QVSPChannel::id() const
+{
+    return _id;
+}
+
+int QVSPChannel::weight() const
+{
+    return _weight;
+}
+
+/*!
+ * \brief QVSPChannel::setWeight Sets the share of the link bandwidth of this
+ * channel relative to the other channels with pending data
+ * \param weight 1 .. INT_MAX
+ */
+void QVSPChannel::setWeight(int weight)
+{
+    _weight = qMax(1, weight);
+}
+
+int QVSPChannel::maxBufferSize() const
+{
+    return _maxBufferSize;
+}
+
+/*!
+ * \brief QVSPMultiplexSocket::QVSPMultiplexSocket Creates a socket carrying
+ * several logical channels over one VSP link
+ * \param parent parent
+ *
+ * Every message carries a channel byte in front of the payload. The peer has
+ * to implement the same protocol.
+ */
+QVSPMultiplexSocket::QVSPMultiplexSocket(QObject* parent)
+    : QVSPMessageSocket(parent)
+{
+    // refill the write buffer as packets leave
+    connect(this, &QIODevice::bytesWritten, [this]() {
+        schedule();
+    });
+    connect(this, &QVSPSocket::connected, [this]() {
+        schedule();
+    });
+}
+
+/*!
+ * \brief QVSPMultiplexSocket::schedule Moves channel data into the write buffer
+ *
+ * The write buffer is only filled up to lowWatermark(), so that data of a
+ * higher weighted channel never waits behind a large backlog of another one.
+ * Among the channels with pending data the one with the lowest virtual time
+ * is served next, one chunk at a time; each chunk advances the channel's
+ * virtual time by its size divided by the channel weight.
+ */
+void QVSPMultiplexSocket::schedule()
+{
+    if (scheduling || !isOpen())
+        return;
+    scheduling = true; // writes may process events and re-enter
+
+    while (bytesToWrite() < _lowWatermark)
+    {
+        QVSPChannel *next = nullptr;
+        for (QVSPChannel *channel: channels)
+        {
+            if (!channel->writeBuffer.isEmpty() && !channel->remotePaused && (next == nullptr || channel->pass < next->pass))
+                next = channel;
+        }
+        if (next == nullptr)
+            break;
+
+        const int n = qMin(next->writeBuffer.size(), qMin(_chunkSize, maxMessageSize() - 1));
+        const char id = char(next->_id);
+        if (!writeFrame({ QByteArray::fromRawData(&id, 1), next->writeBuffer.left(n) }))
+            break;
+
+        next->writeBuffer.remove(0, n);
+        virtualTime = next->pass;
+        next->pass += double(n) / next->_weight;
+        emit next->bytesWritten(n);
+    }
+
+    scheduling = false;
+}
+
+void QVSPMultiplexSocket::sendFlowControl(quint8 id, bool resume)
+{
+    if (!isOpen())
+        return;
+
+    const char frame[2] = { char(id | CONTROL_FLAG), resume ? FLOW_RESUME : FLOW_PAUSE };
+    writeFrame({ QByteArray::fromRawData(frame, 2) }, Priority::High);
+}
+
+/*!
+ * \brief QVSPMultiplexSocket::processMessage Dispatches a received message to
+ * its channel
+ * \param message channel byte followed by the payload
+ *
+ * A channel whose read buffer fills beyond half of its capacity is paused at
+ * the peer and resumed once the application has drained it to a quarter.
+ */
+void QVSPMultiplexSocket::processMessage(const QByteArray &message)
+{
+    if (message.isEmpty())
+        return;
+
+    const quint8 header = quint8(message.at(0));
+    QVSPChannel *channel = channels.value(header & MAX_CHANNEL_ID);
+    if (channel == nullptr)
+        return; // unknown channel
+
+    if (header & CONTROL_FLAG)
+    {
+        if (message.size() >= 2)
+        {
+            channel->remotePaused = message.at(1) == FLOW_PAUSE;
+            if (!channel->remotePaused)
+                schedule();
+        }
+        return;
+    }
+
+    const int len = message.size() - 1;
+    if (channel->readBuffer.size() + len > channel->_maxBufferSize)
+    {
+        setError(QLowEnergyService::ServiceError::CharacteristicReadError,
+                 tr("Channel %1 read buffer overflow (max. size %2), data dropped").arg(channel->_id).arg(channel->_maxBufferSize));
+        return;
+    }
+
+    channel->readBuffer.append(message.constData() + 1, len);
+    if (!channel->localPaused && channel->readBuffer.size() > channel->_maxBufferSize / 2)
+    {
+        channel->localPaused = true;
+        sendFlowControl(channel->_id, false);
+    }
+
+    emit channel->readyRead();
+}
+
+/*!
+ * \brief QVSPMultiplexSocket::close Closes the connection and discards all
+ * channel buffers
+ */
+void QVSPMultiplexSocket::close()
+{
+    QVSPMessageSocket::close();
+
+    for (QVSPChannel *channel: channels)
+    {
+        channel->readBuffer.clear();
+        channel->writeBuffer.clear();
+        channel->localPaused = false;
+        channel->remotePaused = false;
+        channel->pass = 0;
+    }
+    virtualTime = 0;
+}
+
+/*!
+ * \brief QVSPMultiplexSocket::createChannel Creates a logical channel
+ * \param id channel number, 0 .. 127
+ * \param weight bandwidth share relative to the other channels
+ * \param maxBufferSize capacity of the channel read and write buffers
+ * \return the channel, owned by the socket, or nullptr if \a id is invalid or
+ * already in use
+ */
+QVSPChannel *QVSPMultiplexSocket::createChannel(quint8 id, int weight, int maxBufferSize)
+{
+    if (id > MAX_CHANNEL_ID || channels.contains(id))
+        return nullptr;
+
+    QVSPChannel *channel = new QVSPChannel(this, id, weight, maxBufferSize);
+    channels.insert(id, channel);
+    return channel;
+}
+
+QVSPChannel *QVSPMultiplexSocket::channel(quint8 id) const
+{
+    return channels.value(id);
+}
+
+int QVSPMultiplexSocket::chunkSize() const
+{
+    return _chunkSize;
+}
+
+/*!
+ * \brief QVSPMultiplexSocket::setChunkSize Sets the maximum payload of one
+ * channel frame
+ *
+ * Smaller chunks interleave the channels more finely at the cost of more
+ * framing overhead.
+ */
+void QVSPMultiplexSocket::setChunkSize(int chunkSize)
+{
+    _chunkSize = qMax(1, chunkSize);
+}
+
+int QVSPMultiplexSocket::lowWatermark() const
+{
+    return _lowWatermark;
+}
+
+/*!
+ * \brief QVSPMultiplexSocket::setLowWatermark Sets up to which fill level the
+ * socket write buffer is refilled from the channels
+ */
+void QVSPMultiplexSocket::setLowWatermark(int lowWatermark)
+{
+    _lowWatermark = qMax(1, lowWatermark);
+}
+
+} // namespace
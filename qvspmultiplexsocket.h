@@ -0,0 +1,117 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPMULTIPLEXSOCKET_H
+#define QVSPMULTIPLEXSOCKET_H
+
+#include "qvspmessagesocket.h"
+#include <QMap>
+
+namespace MiVSP
+{
+
+class QVSPMultiplexSocket;
+
+class QVSPSOCKETSHARED_EXPORT QVSPChannel : public QIODevice
+{
+    Q_OBJECT
+
+    friend class QVSPMultiplexSocket;
+
+private:
+    QVSPMultiplexSocket *mux;
+    quint8 _id;
+    int _weight;
+    int _maxBufferSize;
+
+    QByteArray readBuffer;
+    QByteArray writeBuffer;
+    bool localPaused = false; // we asked the peer to pause this channel
+    bool remotePaused = false; // the peer asked us to pause this channel
+    double pass = 0; // scheduler virtual time
+
+    QVSPChannel(QVSPMultiplexSocket *mux, quint8 id, int weight, int maxBufferSize);
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *data, qint64 len) override;
+
+public:
+    bool isSequential() const override;
+    qint64 bytesAvailable() const override;
+    qint64 bytesToWrite() const override;
+    bool canReadLine() const override;
+
+    quint8 id() const;
+    int weight() const;
+    void setWeight(int weight);
+    int maxBufferSize() const;
+};
+
+class QVSPSOCKETSHARED_EXPORT QVSPMultiplexSocket : public QVSPMessageSocket
+{
+    Q_OBJECT
+
+    friend class QVSPChannel;
+
+private:
+    QMap<quint8, QVSPChannel*> channels;
+    int _chunkSize = 64;
+    int _lowWatermark = 64;
+    double virtualTime = 0;
+    bool scheduling = false;
+
+    void schedule();
+    void sendFlowControl(quint8 id, bool resume);
+
+protected:
+    void processMessage(const QByteArray &message) override;
+
+public:
+    explicit QVSPMultiplexSocket(QObject* parent = nullptr);
+
+    void close() override;
+
+    QVSPChannel *createChannel(quint8 id, int weight = 1, int maxBufferSize = 4096);
+    QVSPChannel *channel(quint8 id) const;
+
+    int chunkSize() const;
+    void setChunkSize(int chunkSize);
+    int lowWatermark() const;
+    void setLowWatermark(int lowWatermark);
+};
+
+} // namespace
+
+#endif // QVSPMULTIPLEXSOCKET_H
@@ -0,0 +1,306 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspptybridge.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace MiVSP
+{
+
+/*!
+ * \brief QVSPPtyBridge::QVSPPtyBridge Creates a bridge between a
+ * pseudo-terminal and a socket
+ * \param socket socket, has to outlive the bridge
+ * \param parent parent
+ *
+ * Tools which only talk to a serial device node can use the slave side of
+ * the pseudo-terminal, see slaveName(). The bridge moves data in both
+ * directions in large chunks as soon as the pty or the socket is ready,
+ * without polling:
+ * - pty to socket: the master is only read while the socket write buffer can
+ *   take the data, otherwise the pty buffer fills up and the writing tool
+ *   blocks;
+ * - socket to pty: data the pty does not accept is kept and RTS is cleared
+ *   until the pty has taken it, so that the device stops sending.
+ *
+ * CTS is mirrored onto the pty modem lines where the pty driver supports the
+ * TIOCM ioctls (Linux ptys do not, there the flow control above applies).
+ */
+QVSPPtyBridge::QVSPPtyBridge(QVSPSocket *socket, QObject* parent)
+    : QObject(parent), socket(socket)
+{
+    connect(socket, &QIODevice::readyRead, this, [this]() {
+        socketToPty();
+    });
+    connect(socket, &QIODevice::bytesWritten, this, [this]() {
+        ptyToSocket(); // room in the write buffer again
+    });
+    connect(socket, &QVSPSocket::connected, this, [this]() {
+        ptyToSocket();
+    });
+    connect(socket, &QVSPSocket::clearToSendChanged, this, [this](bool set) {
+        updateCTS(set);
+    });
+}
+
+QVSPPtyBridge::~QVSPPtyBridge()
+{
+    close();
+}
+
+/*!
+ * \brief QVSPPtyBridge::open Creates the pseudo-terminal
+ * \return true on success, see errorString() otherwise
+ *
+ * The slave side is configured raw, so data passes unaltered.
+ */
+bool QVSPPtyBridge::open()
+{
+    close();
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        setSystemError(tr("Cannot create pseudo-terminal"));
+        close();
+        return false;
+    }
+
+    const char *name = ptsname(master);
+    slave = name != nullptr ? ::open(name, O_RDWR | O_NOCTTY) : -1;
+    termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) != 0)
+    {
+        setSystemError(tr("Cannot open pseudo-terminal slave"));
+        close();
+        return false;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    _slaveName = QString::fromLocal8Bit(name);
+
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    readNotifier.reset(new QSocketNotifier(master, QSocketNotifier::Read));
+    connect(readNotifier.data(), &QSocketNotifier::activated, this, [this]() {
+        ptyToSocket();
+    });
+    writeNotifier.reset(new QSocketNotifier(master, QSocketNotifier::Write));
+    writeNotifier->setEnabled(false);
+    connect(writeNotifier.data(), &QSocketNotifier::activated, this, [this]() {
+        socketToPty();
+    });
+
+    inbound.resize(CHUNK_SIZE);
+    outbound.resize(CHUNK_SIZE);
+    outboundOffset = outbound.size();
+    modemLines = true;
+    updateCTS(socket->isClearToSend());
+
+    socketToPty(); // data received before
+    return true;
+}
+
+/*!
+ * \brief QVSPPtyBridge::close Removes the pseudo-terminal
+ *
+ * Data not yet accepted by the pty is discarded and RTS, if cleared by the
+ * bridge, is set again.
+ */
+void QVSPPtyBridge::close()
+{
+    if (holdingRTS)
+    {
+        holdingRTS = false;
+        socket->setRTS();
+    }
+    readNotifier.reset();
+    writeNotifier.reset();
+    if (slave >= 0)
+        ::close(slave);
+    if (master >= 0)
+        ::close(master);
+    slave = -1;
+    master = -1;
+    _slaveName.clear();
+    outboundOffset = outbound.size();
+}
+
+bool QVSPPtyBridge::isOpen() const
+{
+    return master >= 0;
+}
+
+/*!
+ * \brief QVSPPtyBridge::slaveName Returns the device node of the terminal
+ * \return e.g. /dev/pts/3, empty if not open
+ */
+QString QVSPPtyBridge::slaveName() const
+{
+    return _slaveName;
+}
+
+QString QVSPPtyBridge::errorString() const
+{
+    return _errorString;
+}
+
+/*!
+ * \brief QVSPPtyBridge::ptyToSocket Moves data written by the tool to the
+ * socket, as much as its write buffer takes
+ */
+void QVSPPtyBridge::ptyToSocket()
+{
+    if (master < 0 || readingPty)
+        return;
+    readingPty = true;
+
+    while (master >= 0 && socket->isOpen())
+    {
+        const qint64 room = socket->writeRoom();
+        if (room <= 0)
+            break; // resumed by bytesWritten()
+
+        const ssize_t n = ::read(master, inbound.data(), size_t(qMin<qint64>(room, inbound.size())));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            // EAGAIN: drained; EIO cannot happen as the slave is kept open
+            readNotifier->setEnabled(true);
+            readingPty = false;
+            return;
+        }
+
+        if (socket->write(QByteArray::fromRawData(inbound.constData(), int(n))) < 0)
+            break;
+    }
+
+    // the tool blocks once the pty buffer is full
+    if (!readNotifier.isNull())
+        readNotifier->setEnabled(false);
+    readingPty = false;
+}
+
+/*!
+ * \brief QVSPPtyBridge::socketToPty Moves received data to the tool
+ */
+void QVSPPtyBridge::socketToPty()
+{
+    if (master < 0 || readingSocket || !drainOutbound())
+        return;
+    readingSocket = true;
+
+    while (master >= 0 && socket->isOpen() && socket->bytesAvailable() > 0)
+    {
+        const qint64 n = socket->read(outbound.data(), outbound.size());
+        if (n <= 0)
+            break;
+        outbound.resize(int(n));
+        outboundOffset = 0;
+        if (!drainOutbound())
+            break;
+    }
+
+    readingSocket = false;
+}
+
+/*!
+ * \brief QVSPPtyBridge::drainOutbound Writes pending data to the pty
+ * \return true if nothing is pending anymore
+ */
+bool QVSPPtyBridge::drainOutbound()
+{
+    while (outboundOffset < outbound.size())
+    {
+        const ssize_t n = ::write(master, outbound.constData() + outboundOffset, size_t(outbound.size() - outboundOffset));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                outboundOffset = outbound.size(); // drop it, the tool is gone
+                setSystemError(tr("Cannot write to pseudo-terminal"));
+                if (master < 0)
+                    return false; // closed by a slot
+                break;
+            }
+
+            // pty full, hold the device back until the tool reads
+            writeNotifier->setEnabled(true);
+            if (!holdingRTS)
+            {
+                holdingRTS = true;
+                socket->unsetRTS();
+            }
+            return false;
+        }
+        outboundOffset += int(n);
+    }
+
+    outbound.resize(CHUNK_SIZE);
+    outboundOffset = outbound.size();
+    writeNotifier->setEnabled(false);
+    if (holdingRTS)
+    {
+        holdingRTS = false;
+        socket->setRTS();
+    }
+    return true;
+}
+
+void QVSPPtyBridge::updateCTS(bool set)
+{
+    if (master < 0 || !modemLines)
+        return;
+
+    const int bits = TIOCM_CTS;
+    if (ioctl(master, set ? TIOCMBIS : TIOCMBIC, &bits) != 0)
+        modemLines = false; // not supported by the pty driver, do not retry
+}
+
+void QVSPPtyBridge::setSystemError(const QString &what)
+{
+    _errorString = QStringLiteral("%1: %2").arg(what, QString::fromLocal8Bit(strerror(errno)));
+    emit error();
+}
+
+} // namespace
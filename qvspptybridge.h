@@ -0,0 +1,91 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPPTYBRIDGE_H
+#define QVSPPTYBRIDGE_H
+
+#include "qvspsocket.h"
+#include <QSocketNotifier>
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPPtyBridge : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int CHUNK_SIZE = 16384;
+
+private:
+    QVSPSocket *socket;
+    int master = -1;
+    int slave = -1; // kept open, so that clients may come and go
+    QString _slaveName;
+    QString _errorString;
+
+    QScopedPointer<QSocketNotifier> readNotifier;
+    QScopedPointer<QSocketNotifier> writeNotifier;
+    QByteArray inbound; // read from the pty
+    QByteArray outbound; // read from the socket, not yet accepted by the pty
+    int outboundOffset = 0;
+    bool readingPty = false; // socket writes may process events and re-enter
+    bool readingSocket = false;
+    bool modemLines = true; // the pty driver supports TIOCM ioctls
+    bool holdingRTS = false; // RTS cleared by the bridge until the pty takes data
+
+    void ptyToSocket();
+    void socketToPty();
+    bool drainOutbound();
+    void updateCTS(bool set);
+    void setSystemError(const QString &what);
+
+public:
+    explicit QVSPPtyBridge(QVSPSocket *socket, QObject* parent = nullptr);
+    ~QVSPPtyBridge();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    QString slaveName() const;
+    QString errorString() const;
+
+signals:
+    void error();
+};
+
+} // namespace
+
+#endif // QVSPPTYBRIDGE_H
@@ -0,0 +1,430 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspreliablesocket.h"
+
+namespace MiVSP
+{
+
+// frame types
+static const char FRAME_DATA = 0x01; // type, seq (2 byte), payload
+static const char FRAME_ACK = 0x02;  // type, next expected seq (2 byte), SACK bitmap (4 byte)
+static const int DATA_HEADER_SIZE = 3;
+static const int ACK_SIZE = 7;
+
+// the SACK bitmap covers 32 frames past the cumulative acknowledgement
+static const int MAX_WINDOW = 32;
+
+/*!
+ * \brief QVSPReliableSocket::QVSPReliableSocket Creates a new socket with
+ * selective-repeat retransmission of messages
+ * \param parent parent
+ *
+ * Every message is sent as a sequence-numbered data frame. The peer answers
+ * with a cumulative acknowledgement plus a bitmap of frames received out of
+ * order, so that only missing frames are sent again. The peer has to
+ * implement the same protocol.
+ */
+QVSPReliableSocket::QVSPReliableSocket(QObject* parent)
+    : QVSPMessageSocket(parent), sendWindow(MAX_WINDOW), receiveWindow(MAX_WINDOW),
+      retransmitTimer(this), ackTimer(this)
+{
+    ackTimer.setSingleShot(true);
+    setConnectionInterval(_connectionInterval);
+
+    connect(&retransmitTimer, &QTimer::timeout, [this]() {
+        retransmit();
+    });
+    connect(&ackTimer, &QTimer::timeout, [this]() {
+        sendAck();
+    });
+    connect(this, &QVSPSocket::connected, [this]() {
+        resetProtocol(); // both sides start counting from zero
+    });
+
+    clock.start();
+}
+
+void QVSPReliableSocket::resetProtocol()
+{
+    retransmitTimer.stop();
+    ackTimer.stop();
+    sendWindow.fill(SendSlot());
+    receiveWindow.fill(ReceiveSlot());
+    sendQueue.clear();
+    sendBase = 0;
+    nextSeq = 0;
+    receiveBase = 0;
+    srtt = 0;
+    rttvar = 0;
+    rto = 4 * _connectionInterval;
+}
+
+/*!
+ * \brief QVSPReliableSocket::fillWindow Sends queued messages while the send
+ * window has room
+ */
+void QVSPReliableSocket::fillWindow()
+{
+    while (!sendQueue.isEmpty() && quint16(nextSeq - sendBase) < _windowSize)
+    {
+        SendSlot &slot = sendWindow[nextSeq % MAX_WINDOW];
+        slot.payload = sendQueue.dequeue();
+        slot.transmissions = 0;
+        slot.acked = false;
+        transmit(nextSeq++);
+    }
+}
+
+/*!
+ * \brief QVSPReliableSocket::transmit (Re)sends the data frame with sequence
+ * number \a seq
+ *
+ * A frame that cannot be queued (e.g. write buffer full) is not counted as a
+ * transmission and is tried again on timeout.
+ */
+void QVSPReliableSocket::transmit(quint16 seq)
+{
+    SendSlot &slot = sendWindow[seq % MAX_WINDOW];
+    slot.sentAt = clock.elapsed();
+    if (!retransmitTimer.isActive())
+        retransmitTimer.start();
+
+    const char header[DATA_HEADER_SIZE] = { FRAME_DATA, char(seq >> 8), char(seq) };
+    if (!writeFrame({ QByteArray::fromRawData(header, DATA_HEADER_SIZE), slot.payload }))
+        return;
+
+    if (slot.transmissions++ > 0)
+        ++counters.retransmissions;
+    else
+        ++counters.framesSent;
+}
+
+/*!
+ * \brief QVSPReliableSocket::retransmit Resends every unacknowledged frame
+ * whose (exponentially backed off) timeout has expired
+ */
+void QVSPReliableSocket::retransmit()
+{
+    const qint64 now = clock.elapsed();
+    for (quint16 seq = sendBase; seq != nextSeq; ++seq)
+    {
+        const SendSlot &slot = sendWindow[seq % MAX_WINDOW];
+        if (slot.acked || now - slot.sentAt < qint64(rto) << qBound(0, slot.transmissions - 1, 4))
+            continue;
+
+        if (slot.transmissions >= _maxTransmissions)
+        {
+            setError(QLowEnergyService::ServiceError::OperationError,
+                     tr("Message not acknowledged after %1 transmissions, connection closed").arg(slot.transmissions));
+            close();
+            return;
+        }
+        transmit(seq);
+    }
+
+    if (sendBase == nextSeq)
+        retransmitTimer.stop();
+}
+
+/*!
+ * \brief QVSPReliableSocket::acknowledge Marks a sent frame as acknowledged
+ * and updates the round trip time estimate
+ *
+ * Only frames transmitted once are sampled (Karn's algorithm).
+ */
+void QVSPReliableSocket::acknowledge(quint16 seq, qint64 now)
+{
+    SendSlot &slot = sendWindow[seq % MAX_WINDOW];
+    if (slot.acked)
+        return;
+
+    if (slot.transmissions == 1)
+    {
+        const double sample = now - slot.sentAt;
+        if (srtt == 0)
+        {
+            srtt = sample;
+            rttvar = sample / 2;
+        }
+        else
+        {
+            rttvar = 0.75 * rttvar + 0.25 * qAbs(srtt - sample);
+            srtt = 0.875 * srtt + 0.125 * sample;
+        }
+        // an acknowledgement needs at least two connection events
+        rto = qMax(2 * _connectionInterval, int(srtt + 4 * rttvar));
+    }
+
+    slot.acked = true;
+    slot.payload.clear();
+    emit messageAcknowledged();
+}
+
+void QVSPReliableSocket::handleAck(const QByteArray &frame)
+{
+    if (frame.size() < ACK_SIZE)
+        return;
+
+    const uchar *p = reinterpret_cast<const uchar *>(frame.constData());
+    const quint16 cumulative = quint16(p[1] << 8 | p[2]);
+    const quint32 sack = quint32(p[3]) << 24 | quint32(p[4]) << 16 | quint32(p[5]) << 8 | p[6];
+
+    const quint16 inFlight = nextSeq - sendBase;
+    if (quint16(cumulative - sendBase) > inFlight)
+        return; // stale acknowledgement
+
+    const qint64 now = clock.elapsed();
+    for (; sendBase != cumulative; ++sendBase)
+        acknowledge(sendBase, now);
+
+    quint16 highest = cumulative;
+    for (int i = 0; i < MAX_WINDOW; ++i)
+    {
+        const quint16 seq = quint16(cumulative + 1 + i);
+        if ((sack >> i & 1) && quint16(seq - sendBase) < quint16(nextSeq - sendBase))
+        {
+            acknowledge(seq, now);
+            highest = seq;
+        }
+    }
+
+    // frames below the highest selectively acknowledged one are most likely
+    // lost, resend them unless they have been sent within the last connection
+    // event already; the retransmission limit is enforced on timeout
+    for (quint16 seq = sendBase; seq != highest; ++seq)
+    {
+        const SendSlot &slot = sendWindow[seq % MAX_WINDOW];
+        if (!slot.acked && slot.transmissions < _maxTransmissions && now - slot.sentAt >= _connectionInterval)
+            transmit(seq);
+    }
+
+    fillWindow();
+    if (sendBase == nextSeq)
+        retransmitTimer.stop();
+}
+
+void QVSPReliableSocket::handleData(const QByteArray &frame)
+{
+    if (frame.size() < DATA_HEADER_SIZE)
+        return;
+
+    const quint16 seq = quint16(quint8(frame.at(1)) << 8 | quint8(frame.at(2)));
+    const quint16 offset = seq - receiveBase;
+    ReceiveSlot &slot = receiveWindow[seq % MAX_WINDOW];
+    if (offset >= MAX_WINDOW || slot.present)
+    {
+        // already delivered (our acknowledgement got lost) or out of window
+        ++counters.duplicatesReceived;
+        sendAck();
+        return;
+    }
+
+    slot.payload = frame.mid(DATA_HEADER_SIZE);
+    slot.present = true;
+
+    while (receiveWindow[receiveBase % MAX_WINDOW].present)
+    {
+        ReceiveSlot &next = receiveWindow[receiveBase % MAX_WINDOW];
+        const QByteArray message = next.payload;
+        next.payload.clear();
+        next.present = false;
+        ++receiveBase;
+        emit messageReceived(message);
+    }
+
+    if (offset == 0 && !ackTimer.isActive())
+        ackTimer.start(); // in order, acknowledge with the next connection event
+    else if (offset != 0)
+        sendAck(); // report the gap at once
+}
+
+/*!
+ * \brief QVSPReliableSocket::sendAck Sends the cumulative acknowledgement and
+ * the bitmap of frames received past it
+ */
+void QVSPReliableSocket::sendAck()
+{
+    ackTimer.stop();
+    if (!isOpen())
+        return;
+
+    quint32 sack = 0;
+    for (int i = 0; i < MAX_WINDOW; ++i)
+    {
+        if (receiveWindow[(receiveBase + 1 + i) % MAX_WINDOW].present)
+            sack |= 1u << i;
+    }
+
+    const char ack[ACK_SIZE] = {
+        FRAME_ACK, char(receiveBase >> 8), char(receiveBase),
+        char(sack >> 24), char(sack >> 16), char(sack >> 8), char(sack)
+    };
+    if (writeFrame({ QByteArray::fromRawData(ack, ACK_SIZE) }, Priority::High))
+        ++counters.acksSent;
+}
+
+void QVSPReliableSocket::processMessage(const QByteArray &message)
+{
+    if (message.isEmpty())
+        return;
+
+    if (message.at(0) == FRAME_DATA)
+        handleData(message);
+    else if (message.at(0) == FRAME_ACK)
+        handleAck(message);
+}
+
+/*!
+ * \brief QVSPReliableSocket::close Closes the connection and drops all
+ * unacknowledged messages
+ */
+void QVSPReliableSocket::close()
+{
+    QVSPMessageSocket::close();
+    resetProtocol();
+}
+
+/*!
+ * \brief QVSPReliableSocket::writeMessage Queues a message for reliable
+ * delivery
+ * \param message message payload
+ * \return true if the message has been queued
+ *
+ * The message is sent as soon as the send window has room and is repeated
+ * until it is acknowledged, at most maxTransmissions() times.
+ */
+bool QVSPReliableSocket::writeMessage(const QByteArray &message)
+{
+    if (!isOpen())
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("Cannot write while not connected"));
+        return false;
+    }
+    if (message.size() > maxMessageSize() - DATA_HEADER_SIZE)
+    {
+        setError(QLowEnergyService::ServiceError::OperationError,
+                 tr("Outgoing message too large (%1 byte, max. size %2), write failed").arg(message.size()).arg(maxMessageSize() - DATA_HEADER_SIZE));
+        return false;
+    }
+
+    sendQueue.enqueue(message);
+    fillWindow();
+    return true;
+}
+
+/*!
+ * \brief QVSPReliableSocket::messagesToWrite Returns the number of messages not
+ * acknowledged yet, including the ones waiting for a window slot
+ */
+qint64 QVSPReliableSocket::messagesToWrite() const
+{
+    qint64 count = sendQueue.size();
+    for (quint16 seq = sendBase; seq != nextSeq; ++seq)
+    {
+        if (!sendWindow[seq % MAX_WINDOW].acked)
+            ++count;
+    }
+    return count;
+}
+
+int QVSPReliableSocket::windowSize() const
+{
+    return _windowSize;
+}
+
+/*!
+ * \brief QVSPReliableSocket::setWindowSize Sets the number of frames that may
+ * be in flight unacknowledged
+ * \param windowSize 1 .. 32
+ *
+ * The write buffer should be able to hold a full window of messages.
+ */
+void QVSPReliableSocket::setWindowSize(int windowSize)
+{
+    _windowSize = qBound(1, windowSize, MAX_WINDOW);
+}
+
+int QVSPReliableSocket::connectionInterval() const
+{
+    return _connectionInterval;
+}
+
+/*!
+ * \brief QVSPReliableSocket::setConnectionInterval Tunes the timers to the BLE
+ * connection interval
+ * \param msecs connection interval in ms (7.5 .. 4000 in BLE, default 30)
+ *
+ * Acknowledgements are delayed by at most one interval, so that they travel
+ * with the next connection event, and the retransmission timeout never drops
+ * below two intervals.
+ */
+void QVSPReliableSocket::setConnectionInterval(int msecs)
+{
+    _connectionInterval = qMax(1, msecs);
+    retransmitTimer.setInterval(_connectionInterval);
+    ackTimer.setInterval(_connectionInterval);
+    rto = qMax(rto, 2 * _connectionInterval);
+    if (srtt == 0)
+        rto = 4 * _connectionInterval;
+}
+
+int QVSPReliableSocket::maxTransmissions() const
+{
+    return _maxTransmissions;
+}
+
+/*!
+ * \brief QVSPReliableSocket::setMaxTransmissions Sets how often a frame is sent
+ * before the connection is given up
+ */
+void QVSPReliableSocket::setMaxTransmissions(int maxTransmissions)
+{
+    _maxTransmissions = qMax(1, maxTransmissions);
+}
+
+/*!
+ * \brief QVSPReliableSocket::reliabilityCounters Returns the protocol counters
+ */
+QVSPReliableSocket::ReliabilityCounters QVSPReliableSocket::reliabilityCounters() const
+{
+    return counters;
+}
+
+void QVSPReliableSocket::resetReliabilityCounters()
+{
+    counters = ReliabilityCounters();
+}
+
+} // namespace
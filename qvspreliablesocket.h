@@ -0,0 +1,130 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPRELIABLESOCKET_H
+#define QVSPRELIABLESOCKET_H
+
+#include "qvspmessagesocket.h"
+#include <QVector>
+#include <QQueue>
+#include <QTimer>
+#include <QElapsedTimer>
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPReliableSocket : public QVSPMessageSocket
+{
+    Q_OBJECT
+
+public:
+    struct ReliabilityCounters
+    {
+        quint64 framesSent = 0; // data frames, first transmissions only
+        quint64 retransmissions = 0;
+        quint64 duplicatesReceived = 0;
+        quint64 acksSent = 0;
+    };
+
+private:
+    struct SendSlot
+    {
+        QByteArray payload;
+        qint64 sentAt = 0; // ms on clock
+        int transmissions = 0;
+        bool acked = false;
+    };
+    struct ReceiveSlot
+    {
+        QByteArray payload;
+        bool present = false;
+    };
+
+    int _windowSize = 16;
+    int _connectionInterval = 30; // ms
+    int _maxTransmissions = 8;
+
+    QVector<SendSlot> sendWindow;
+    QVector<ReceiveSlot> receiveWindow;
+    QQueue<QByteArray> sendQueue; // messages waiting for a free window slot
+    quint16 sendBase = 0; // oldest unacknowledged sequence number
+    quint16 nextSeq = 0;
+    quint16 receiveBase = 0; // next sequence number expected in order
+
+    QTimer retransmitTimer;
+    QTimer ackTimer; // delayed acknowledgement
+    QElapsedTimer clock;
+    double srtt = 0; // smoothed round trip time, ms
+    double rttvar = 0;
+    int rto = 0; // retransmission timeout, ms
+
+    ReliabilityCounters counters;
+
+    void resetProtocol();
+    void fillWindow();
+    void transmit(quint16 seq);
+    void retransmit();
+    void acknowledge(quint16 seq, qint64 now);
+    void handleAck(const QByteArray &frame);
+    void handleData(const QByteArray &frame);
+    void sendAck();
+
+protected:
+    void processMessage(const QByteArray &message) override;
+
+public:
+    explicit QVSPReliableSocket(QObject* parent = nullptr);
+
+    void close() override;
+
+    bool writeMessage(const QByteArray &message) override;
+    qint64 messagesToWrite() const;
+
+    int windowSize() const;
+    void setWindowSize(int windowSize);
+    int connectionInterval() const;
+    void setConnectionInterval(int msecs);
+    int maxTransmissions() const;
+    void setMaxTransmissions(int maxTransmissions);
+
+    ReliabilityCounters reliabilityCounters() const;
+    void resetReliabilityCounters();
+
+signals:
+    void messageAcknowledged();
+};
+
+} // namespace
+
+#endif // QVSPRELIABLESOCKET_H
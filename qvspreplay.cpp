@@ -0,0 +1,404 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspreplay.h"
+#include <QtEndian>
+
+namespace MiVSP
+{
+
+using Event = QVSPTraceRecorder::Event;
+using Characteristic = QVSPTraceRecorder::Characteristic;
+
+// acknowledgement latency used when the trace provides none, one minimum connection interval
+static const qint64 DEFAULT_LATENCY = 7500000; // ns
+
+/*!
+ * \brief QVSPTraceReplay::QVSPTraceReplay Creates a replay driver
+ * \param socket socket to be driven, it must not be connected
+ * \param parent parent
+ *
+ * The driver replays a trace recorded by QVSPTraceRecorder against the socket
+ * over a simulated link instead of a Bluetooth LE service: the recorded TX
+ * FIFO and CTS notifications are delivered at their recorded time, every
+ * characteristic write of the socket is acknowledged after the latency the
+ * recorded device showed for the corresponding write, and the recorded RX
+ * FIFO data is written again as application data. The socket then has to
+ * cope with the exact flow control and timing conditions of the recorded
+ * session, and report() tells how it did.
+ *
+ * The application side (e.g. a reader connected to readyRead()) is up to the
+ * caller. Subclasses like QVSPMessageSocket may be driven as well.
+ */
+QVSPTraceReplay::QVSPTraceReplay(QVSPSocket *socket, QObject *parent)
+    : QObject(parent), socket(socket)
+{
+    timer.setSingleShot(true);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, &QTimer::timeout, this, [this]() {
+        step();
+    });
+    connect(socket, static_cast<void(QVSPSocket::*)(QLowEnergyService::ServiceError)>(&QVSPSocket::error), this, [this]() {
+        if (running)
+            ++_report.errors;
+    });
+}
+
+/*!
+ * \brief QVSPTraceReplay::load Loads a trace file
+ * \param path trace file
+ * \return false if the file cannot be read or is not a trace
+ *
+ * The manufacturer is derived from the trace. A truncated last record is
+ * ignored.
+ */
+bool QVSPTraceReplay::load(const QString &path)
+{
+    if (running)
+    {
+        _errorString = tr("Cannot load a trace while replaying");
+        return false;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        _errorString = file.errorString();
+        return false;
+    }
+    const QByteArray trace = file.readAll();
+    const uchar *p = reinterpret_cast<const uchar *>(trace.constData());
+
+    if (trace.size() < QVSPTraceRecorder::FILE_HEADER_SIZE || !trace.startsWith(QByteArrayLiteral("VSPTRACE"))
+            || qFromLittleEndian<quint16>(p + 8) != QVSPTraceRecorder::VERSION
+            || qFromLittleEndian<quint16>(p + 10) < QVSPTraceRecorder::RECORD_HEADER_SIZE)
+    {
+        _errorString = tr("%1 is not a VSP trace").arg(path);
+        return false;
+    }
+    const int headerSize = qFromLittleEndian<quint16>(p + 10);
+
+    records.clear();
+    _manufacturer = QVSPSocket::Manufacturer::Laird;
+    qint64 first = -1;
+    for (int pos = QVSPTraceRecorder::FILE_HEADER_SIZE; trace.size() - pos >= headerSize; )
+    {
+        const qint64 time = qint64(qFromLittleEndian<quint64>(p + pos));
+        const int len = qFromLittleEndian<quint16>(p + pos + 10);
+        if (trace.size() - pos - headerSize < len)
+            break; // truncated
+
+        if (first < 0)
+            first = time;
+        const Record record = { time - first, Event(p[pos + 8]), p[pos + 9], trace.mid(pos + headerSize, len) };
+        records.append(record);
+        if (record.event == Event::CharacteristicWrite && record.arg == quint8(Characteristic::BrspMode))
+            _manufacturer = QVSPSocket::Manufacturer::BlueRadios;
+
+        pos += headerSize + len;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief QVSPTraceReplay::start Connects the socket to the simulated link and
+ * starts replaying
+ * \return false if no trace is loaded or the socket is in use
+ *
+ * finished() is emitted once all recorded events have been delivered and all
+ * writes of the socket have been acknowledged, including data it still holds
+ * back (e.g. a partial packet until its flush deadline); the socket is closed
+ * then. Data the socket cannot send because the last notified CTS is off is
+ * not waited for.
+ */
+bool QVSPTraceReplay::start()
+{
+    if (running || records.isEmpty())
+    {
+        _errorString = running ? tr("Replay already running") : tr("No trace loaded");
+        return false;
+    }
+
+    steps.clear();
+    sequence = 0;
+    dataLatencies.clear();
+    modemLatencies.clear();
+    _report = Report();
+
+    // pair the recorded writes with their acknowledgements to learn the link latency
+    QQueue<qint64> pendingData;
+    QQueue<qint64> pendingModem;
+    bool clearToSend = true;
+    bool ctsKnown = false;
+    for (const Record &record: records)
+    {
+        switch (record.event)
+        {
+        case Event::CharacteristicWrite:
+            if (record.arg == quint8(Characteristic::RxFifo))
+            {
+                pendingData.enqueue(record.time);
+                ++_report.recordedPacketsWritten;
+                _report.recordedBytesWritten += quint64(record.data.size());
+                if (_replayWrites)
+                    schedule(record.time, Action::Write, Characteristic::RxFifo, record.data);
+            }
+            else if (record.arg == quint8(Characteristic::ModemIn))
+            {
+                pendingModem.enqueue(record.time);
+                ++_report.recordedRtsWrites;
+            }
+            break;
+        case Event::CharacteristicWritten:
+            if (record.arg == quint8(Characteristic::RxFifo) && !pendingData.isEmpty())
+                dataLatencies.enqueue(record.time - pendingData.dequeue());
+            else if (record.arg == quint8(Characteristic::ModemIn) && !pendingModem.isEmpty())
+                modemLatencies.enqueue(record.time - pendingModem.dequeue());
+            break;
+        case Event::Notification:
+            if (record.arg == quint8(Characteristic::TxFifo) || record.arg == quint8(Characteristic::ModemOut))
+                schedule(record.time, Action::Notify, Characteristic(record.arg), record.data);
+            break;
+        case Event::Cts:
+            if (!ctsKnown)
+                clearToSend = record.arg != 0;
+            ctsKnown = true;
+            break;
+        default:
+            break;
+        }
+    }
+    _report.recordedDuration = records.last().time;
+    lastDataLatency = dataLatencies.isEmpty() ? DEFAULT_LATENCY : dataLatencies.head();
+    lastModemLatency = modemLatencies.isEmpty() ? DEFAULT_LATENCY : modemLatencies.head();
+
+    now = 0;
+    running = true;
+    wall.start();
+    if (!socket->startReplay(this, _manufacturer, clearToSend))
+    {
+        running = false;
+        steps.clear();
+        _errorString = tr("The socket is in use");
+        return false;
+    }
+
+    timer.start(0);
+    return true;
+}
+
+bool QVSPTraceReplay::isRunning() const
+{
+    return running;
+}
+
+void QVSPTraceReplay::schedule(qint64 at, Action action, Characteristic id, const QByteArray &data)
+{
+    const QPair<qint64, quint64> key(at, sequence++);
+    steps.insert(key, { action, id, data });
+
+    if (running && steps.firstKey() == key)
+        timer.start(0); // earlier than the step waited for
+}
+
+/*!
+ * \brief QVSPTraceReplay::linkTime Returns the current time of the simulated
+ * link in ns
+ */
+qint64 QVSPTraceReplay::linkTime() const
+{
+    return _speed > 0 ? qint64(double(wall.nsecsElapsed()) * _speed) : now;
+}
+
+/*!
+ * \brief QVSPTraceReplay::step Executes the steps which are due
+ */
+void QVSPTraceReplay::step()
+{
+    while (running && !steps.isEmpty())
+    {
+        auto it = steps.begin();
+        const qint64 at = it.key().first;
+        if (_speed > 0)
+        {
+            const qint64 wait = qint64(double(at) / _speed) - wall.nsecsElapsed();
+            if (wait > 0)
+            {
+                timer.start(int((wait + 999999) / 1000000));
+                return;
+            }
+        }
+
+        const Step next = it.value();
+        steps.erase(it);
+        now = qMax(now, at);
+
+        QElapsedTimer busy;
+        busy.start();
+        switch (next.action)
+        {
+        case Action::Notify:
+            ++_report.notifications;
+            if (next.id == Characteristic::TxFifo)
+                _report.bytesReceived += quint64(next.data.size());
+            socket->characteristicChanged(next.id, next.data);
+            break;
+        case Action::Acknowledge:
+            socket->characteristicWritten(next.id, next.data);
+            break;
+        case Action::Write:
+            socket->write(next.data);
+            break;
+        }
+        _report.processingTime += busy.nsecsElapsed();
+
+        if (_speed <= 0)
+        {
+            timer.start(0); // let the event loop run between steps
+            return;
+        }
+    }
+
+    // data still queued in the socket is written once its flush deadline
+    // expires or CTS allows, the write schedules an acknowledgement and
+    // resumes the replay
+    if (running && (socket->bytesToWrite() == 0 || !socket->isClearToSend()))
+        finish();
+}
+
+void QVSPTraceReplay::finish()
+{
+    running = false;
+    timer.stop();
+    _report.replayedDuration = now;
+    socket->close();
+    emit finished();
+}
+
+/*!
+ * \brief QVSPTraceReplay::characteristicWrite Simulates the device receiving a
+ * characteristic write of the socket
+ *
+ * The write is acknowledged after the latency of the recorded write with the
+ * same index; once the recorded ones are exhausted, the last latency is
+ * reused.
+ */
+void QVSPTraceReplay::characteristicWrite(Characteristic id, const QByteArray &value)
+{
+    if (!running)
+        return;
+
+    qint64 latency = lastDataLatency;
+    if (id == Characteristic::RxFifo)
+    {
+        ++_report.packetsWritten;
+        _report.bytesWritten += quint64(value.size());
+        if (!dataLatencies.isEmpty())
+            lastDataLatency = dataLatencies.dequeue();
+        latency = lastDataLatency;
+    }
+    else if (id == Characteristic::ModemIn)
+    {
+        ++_report.rtsWrites;
+        if (!modemLatencies.isEmpty())
+            lastModemLatency = modemLatencies.dequeue();
+        latency = lastModemLatency;
+    }
+
+    schedule(linkTime() + latency, Action::Acknowledge, id, value);
+}
+
+double QVSPTraceReplay::speed() const
+{
+    return _speed;
+}
+
+/*!
+ * \brief QVSPTraceReplay::setSpeed Sets the replay speed
+ * \param speed 1 for the recorded timing, 2 for twice as fast etc., 0 to
+ * replay as fast as possible in recorded order
+ */
+void QVSPTraceReplay::setSpeed(double speed)
+{
+    _speed = qMax(0.0, speed);
+}
+
+bool QVSPTraceReplay::replayWrites() const
+{
+    return _replayWrites;
+}
+
+/*!
+ * \brief QVSPTraceReplay::setReplayWrites Sets whether the recorded RX FIFO
+ * data is written to the socket again
+ * \param replayWrites true (default) to offer the recorded write load, false
+ * to let the caller write
+ *
+ * The data is written at the time it was passed to the link in the recording.
+ */
+void QVSPTraceReplay::setReplayWrites(bool replayWrites)
+{
+    _replayWrites = replayWrites;
+}
+
+QVSPSocket::Manufacturer QVSPTraceReplay::manufacturer() const
+{
+    return _manufacturer;
+}
+
+void QVSPTraceReplay::setManufacturer(QVSPSocket::Manufacturer manufacturer)
+{
+    _manufacturer = manufacturer;
+}
+
+/*!
+ * \brief QVSPTraceReplay::report Returns the results of the last replay
+ *
+ * Comparing packetsWritten with recordedPacketsWritten shows how well the
+ * write path fills packets, replayedDuration against recordedDuration how
+ * the throughput compares, rtsWrites against recordedRtsWrites how the read
+ * side flow control behaves.
+ */
+QVSPTraceReplay::Report QVSPTraceReplay::report() const
+{
+    return _report;
+}
+
+QString QVSPTraceReplay::errorString() const
+{
+    return _errorString;
+}
+
+} // namespace
@@ -0,0 +1,140 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPREPLAY_H
+#define QVSPREPLAY_H
+
+#include "qvspsocket.h"
+#include <QMap>
+#include <QPair>
+#include <QQueue>
+#include <QVector>
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPTraceReplay : public QObject
+{
+    Q_OBJECT
+
+    friend class QVSPSocket;
+
+public:
+    struct Report
+    {
+        qint64 recordedDuration = 0; // ns from the first to the last traced event
+        qint64 replayedDuration = 0; // ns of link time until the last write has been acknowledged
+        quint64 notifications = 0;
+        quint64 bytesReceived = 0;
+        quint64 packetsWritten = 0;
+        quint64 bytesWritten = 0;
+        quint64 recordedPacketsWritten = 0;
+        quint64 recordedBytesWritten = 0;
+        quint64 rtsWrites = 0;
+        quint64 recordedRtsWrites = 0;
+        qint64 processingTime = 0; // ns spent in the socket handling replayed events
+        quint64 errors = 0;
+    };
+
+private:
+    enum class Action
+    {
+        Notify, // deliver a recorded notification
+        Acknowledge, // acknowledge a write of the socket
+        Write // repeat a recorded application write
+    };
+    struct Step
+    {
+        Action action;
+        QVSPTraceRecorder::Characteristic id;
+        QByteArray data;
+    };
+    struct Record
+    {
+        qint64 time; // ns since the first record
+        QVSPTraceRecorder::Event event;
+        quint8 arg;
+        QByteArray data;
+    };
+
+    QVSPSocket *socket;
+    QVector<Record> records;
+    QString _errorString;
+
+    double _speed = 1.0;
+    bool _replayWrites = true;
+    QVSPSocket::Manufacturer _manufacturer = QVSPSocket::Manufacturer::Laird;
+
+    QMap<QPair<qint64, quint64>, Step> steps; // ordered by time and insertion
+    quint64 sequence = 0;
+    QQueue<qint64> dataLatencies; // recorded write acknowledgement latencies, ns
+    QQueue<qint64> modemLatencies;
+    qint64 lastDataLatency = 0;
+    qint64 lastModemLatency = 0;
+    qint64 now = 0; // link time, ns
+    QElapsedTimer wall;
+    QTimer timer;
+    bool running = false;
+    Report _report;
+
+    void schedule(qint64 at, Action action, QVSPTraceRecorder::Characteristic id, const QByteArray &data);
+    qint64 linkTime() const;
+    void step();
+    void finish();
+    void characteristicWrite(QVSPTraceRecorder::Characteristic id, const QByteArray &value);
+
+public:
+    explicit QVSPTraceReplay(QVSPSocket *socket, QObject *parent = nullptr);
+
+    bool load(const QString &path);
+    bool start();
+    bool isRunning() const;
+
+    double speed() const;
+    void setSpeed(double speed);
+    bool replayWrites() const;
+    void setReplayWrites(bool replayWrites);
+    QVSPSocket::Manufacturer manufacturer() const;
+    void setManufacturer(QVSPSocket::Manufacturer manufacturer);
+
+    Report report() const;
+    QString errorString() const;
+
+signals:
+    void finished();
+};
+
+} // namespace
+
+#endif // QVSPREPLAY_H
@@ -0,0 +1,240 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspserialport.h"
+#include <QEventLoop>
+
+namespace MiVSP
+{
+
+// 20 byte packet plus the \0 terminator
+static const qint64 MIN_BUFFER_SIZE = 21;
+
+/*!
+ * \brief QVSPSerialPort::QVSPSerialPort Creates a VSP socket with the
+ * QSerialPort style API
+ * \param parent parent
+ *
+ * Eases the migration of code written against QSerialPort: the modem lines,
+ * clear(), the buffer sizing and the blocking waitFor*() calls are provided
+ * with the QSerialPort names and semantics, directly on top of the socket
+ * buffers. The connection is still established by connectToDevice().
+ */
+QVSPSerialPort::QVSPSerialPort(QObject* parent)
+    : QVSPSocket(parent)
+{
+}
+
+/*!
+ * \brief QVSPSerialPort::QVSPSerialPort Creates a VSP socket with the
+ * QSerialPort style API and a custom maximum buffer size
+ * \param maxBufferSize initial read and write buffer size, 21 .. INT_MAX
+ * \param parent parent
+ */
+QVSPSerialPort::QVSPSerialPort(int maxBufferSize, QObject* parent)
+    : QVSPSocket(maxBufferSize, parent)
+{
+}
+
+/*!
+ * \brief QVSPSerialPort::setRequestToSend Sets or clears the RTS line
+ * \param set true to set RTS
+ * \return false if not connected, or if RTS cannot be set because the read
+ * buffer is full
+ *
+ * The device confirms the new level asynchronously, requestToSendChanged() is
+ * emitted then. Note that RTS stays under automatic flow control: it is set
+ * again as soon as the application reads from a drained buffer.
+ */
+bool QVSPSerialPort::setRequestToSend(bool set)
+{
+    if (!isOpen())
+    {
+        this->setErrorString(tr("Cannot set RTS while not connected"));
+        return false;
+    }
+
+    if (!set)
+    {
+        unsetRTS();
+        return true;
+    }
+
+    setRTS();
+    return QVSPSocket::isRequestToSend();
+}
+
+/*!
+ * \brief QVSPSerialPort::isRequestToSend Returns the requested RTS level
+ *
+ * \sa pinoutSignals() for the level confirmed by the device
+ */
+bool QVSPSerialPort::isRequestToSend() const
+{
+    return QVSPSocket::isRequestToSend();
+}
+
+/*!
+ * \brief QVSPSerialPort::pinoutSignals Returns the state of the modem lines
+ * \return RequestToSendSignal as confirmed by the device and ClearToSendSignal
+ * as notified by it
+ */
+QVSPSerialPort::PinoutSignals QVSPSerialPort::pinoutSignals() const
+{
+    PinoutSignals lines = NoSignal;
+    if (isRequestToSendConfirmed())
+        lines |= RequestToSendSignal;
+    if (isClearToSend())
+        lines |= ClearToSendSignal;
+    return lines;
+}
+
+/*!
+ * \brief QVSPSerialPort::clear Discards the buffered data
+ * \param directions Input discards received data not read yet, Output
+ * discards written data not sent yet
+ * \return false if not connected
+ *
+ * Packets already passed to the link cannot be recalled. Clearing the output
+ * aborts a running file transfer and may cut a frame of a message socket.
+ */
+bool QVSPSerialPort::clear(Directions directions)
+{
+    if (!isOpen())
+    {
+        this->setErrorString(tr("Cannot clear while not connected"));
+        return false;
+    }
+
+    if (directions & Input)
+        discardReceived();
+    if (directions & Output)
+        discardPending();
+
+    return true;
+}
+
+qint64 QVSPSerialPort::readBufferSize() const
+{
+    return readBufferLimit();
+}
+
+/*!
+ * \brief QVSPSerialPort::setReadBufferSize Sets the capacity of the read buffer
+ * \param size bytes, 0 for INT_MAX; at least 21
+ *
+ * RTS is cleared when the buffer cannot take another packet, so the size
+ * bounds the memory used even if the application does not read.
+ */
+void QVSPSerialPort::setReadBufferSize(qint64 size)
+{
+    setReadBufferLimit(int(size <= 0 ? INT_MAX : qBound(MIN_BUFFER_SIZE, size, qint64(INT_MAX))));
+}
+
+qint64 QVSPSerialPort::writeBufferSize() const
+{
+    return writeBufferLimit();
+}
+
+/*!
+ * \brief QVSPSerialPort::setWriteBufferSize Sets the capacity of the write
+ * buffer of each priority class
+ * \param size bytes, 0 for INT_MAX; at least 21
+ *
+ * Writes not fitting the buffer fail.
+ */
+void QVSPSerialPort::setWriteBufferSize(qint64 size)
+{
+    setWriteBufferLimit(int(size <= 0 ? INT_MAX : qBound(MIN_BUFFER_SIZE, size, qint64(INT_MAX))));
+}
+
+/*!
+ * \brief QVSPSerialPort::waitForReadyRead Blocks until new data is available
+ * \param msecs timeout, -1 to wait forever
+ * \return true if readyRead() has been emitted, false on timeout or disconnect
+ *
+ * Events are processed while waiting, as the link is driven by the event loop.
+ */
+bool QVSPSerialPort::waitForReadyRead(int msecs)
+{
+    if (!isOpen())
+        return false;
+
+    bool ready = false;
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    connect(this, &QIODevice::readyRead, &loop, [&]() {
+        ready = true;
+        loop.quit();
+    });
+    connect(this, &QVSPSocket::disconnected, &loop, &QEventLoop::quit);
+    connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    if (msecs >= 0)
+        timer.start(msecs);
+    loop.exec();
+
+    return ready;
+}
+
+/*!
+ * \brief QVSPSerialPort::waitForBytesWritten Blocks until a packet has been
+ * passed to the link
+ * \param msecs timeout, -1 to wait forever
+ * \return true if bytesWritten() has been emitted, false if there is nothing
+ * to write, on timeout or disconnect
+ */
+bool QVSPSerialPort::waitForBytesWritten(int msecs)
+{
+    if (!isOpen() || bytesToWrite() == 0)
+        return false;
+
+    bool written = false;
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    connect(this, &QIODevice::bytesWritten, &loop, [&]() {
+        written = true;
+        loop.quit();
+    });
+    connect(this, &QVSPSocket::disconnected, &loop, &QEventLoop::quit);
+    connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    if (msecs >= 0)
+        timer.start(msecs);
+    loop.exec();
+
+    return written;
+}
+
+} // namespace
@@ -0,0 +1,91 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPSERIALPORT_H
+#define QVSPSERIALPORT_H
+
+#include "qvspsocket.h"
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPSerialPort : public QVSPSocket
+{
+    Q_OBJECT
+
+public:
+    // values as in QSerialPort
+    enum Direction
+    {
+        Input = 1,
+        Output = 2,
+        AllDirections = Input | Output
+    };
+    Q_DECLARE_FLAGS(Directions, Direction)
+    Q_FLAG(Directions)
+
+    enum PinoutSignal
+    {
+        NoSignal = 0x00,
+        RequestToSendSignal = 0x40,
+        ClearToSendSignal = 0x80
+    };
+    Q_DECLARE_FLAGS(PinoutSignals, PinoutSignal)
+    Q_FLAG(PinoutSignals)
+
+public:
+    explicit QVSPSerialPort(QObject* parent = nullptr);
+    explicit QVSPSerialPort(int maxBufferSize, QObject* parent = nullptr);
+
+    bool setRequestToSend(bool set);
+    bool isRequestToSend() const;
+    PinoutSignals pinoutSignals() const;
+
+    bool clear(Directions directions = AllDirections);
+
+    qint64 readBufferSize() const;
+    void setReadBufferSize(qint64 size);
+    qint64 writeBufferSize() const;
+    void setWriteBufferSize(qint64 size);
+
+    bool waitForReadyRead(int msecs = 30000) override;
+    bool waitForBytesWritten(int msecs = 30000) override;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(QVSPSerialPort::Directions)
+Q_DECLARE_OPERATORS_FOR_FLAGS(QVSPSerialPort::PinoutSignals)
+
+} // namespace
+
+#endif // QVSPSERIALPORT_H
@@ -33,10 +33,13 @@
  */
 
 #include "qvspsocket.h"
+#include "qvspcodec.h"
+#include "qvspreplay.h"
 #include <QMap>
-#include <QBuffer>
 #include <QVariant>
 #include <QAbstractEventDispatcher>
+#include <QVarLengthArray>
+#include <cstring>
 
 namespace MiVSP
 {
@@ -108,6 +111,16 @@ static const QMap<Manufacturer, QByteArray> MODEM_CLEAR_BIT =
 
 // maximum packet data size (20 is the default for Bluetooth LE)
 static const int PACKET_SIZE = 20;
+// smaller segments are cheaper to copy than to track
+static const int MIN_SHARED_SEGMENT = 64;
+
+// compressed block header: stored flag and 15 bit payload length, big endian
+static const int BLOCK_HEADER_SIZE = 2;
+static const quint16 BLOCK_STORED = 0x8000;
+static const int MAX_COMPRESSION_BLOCK = 4096;
+
+// file transfers keep this much data queued ahead of the link
+static const int FILE_LOW_WATERMARK = 8 * PACKET_SIZE;
 
 /*!
  * \brief VSPSocket::VSPSocket Creates a new Bluetooth LE VSP socket with the
@@ -115,7 +128,7 @@ static const int PACKET_SIZE = 20;
  * \param parent parent
  */
 QVSPSocket::QVSPSocket(QObject* parent)
-    : QIODevice(parent)
+    : QVSPSocket(4096, parent)
 {
 }
 
@@ -127,8 +140,34 @@ QVSPSocket::QVSPSocket(QObject* parent)
  * \param parent parent
  */
 QVSPSocket::QVSPSocket(int maxBufferSize, QObject* parent)
-    : QIODevice(parent), maxBufferSize(maxBufferSize)
+    : QIODevice(parent), maxBufferSize(maxBufferSize), maxWriteBufferSize(maxBufferSize)
 {
+    clock.start();
+
+    flushTimer.setSingleShot(true);
+    flushTimer.setTimerType(Qt::PreciseTimer);
+    connect(&flushTimer, &QTimer::timeout, [this]() {
+        writeInternal(); // flush deadline of a held back packet expired
+    });
+
+    compressTimer.setSingleShot(true);
+    compressTimer.setTimerType(Qt::PreciseTimer);
+    connect(&compressTimer, &QTimer::timeout, [this]() {
+        compressStaged(); // flush deadline of a partial block expired
+        writeInternal();
+    });
+
+    // refill from a file transfer as packets leave
+    connect(this, &QIODevice::bytesWritten, [this]() {
+        pumpFile();
+    });
+    connect(this, &QVSPSocket::stateChanged, [this](QBluetoothSocket::SocketState state) {
+        trace(QVSPTraceRecorder::Event::StateChange, quint8(state));
+        wakeWaiters(Waiter::Reason::State);
+    });
+    connect(this, static_cast<void(QVSPSocket::*)(QLowEnergyService::ServiceError)>(&QVSPSocket::error), [this]() {
+        wakeWaiters(Waiter::Reason::Error);
+    });
 }
 
 /*!
@@ -144,22 +183,537 @@ QVSPSocket::~QVSPSocket()
 
 /*!
  * \brief VSPSocket::writeInternal Writes data to the RX FIFO characteristic
+ *
+ * Each packet is taken from the highest priority class with pending data. A
+ * class in the middle of an atomic write (e.g. a framed message) is finished
+ * first, so that other classes never split it.
+ *
+ * Without no delay, a partial packet of normal priority data is held back
+ * until it fills up, flush() is called or the flush deadline expires. The
+ * rest of a partially sent atomic write is never held back, as it blocks the
+ * higher priority classes.
  */
 void QVSPSocket::writeInternal()
 {
-    if (cts)
+    if (!cts)
+        return;
+
+    int p = PRIORITY_COUNT - 1;
+    bool finishing = false;
+    for (int i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        const WriteQueue &q = writeQueues[i];
+        if (!q.writes.isEmpty() && q.writes.head().atomic && q.writes.head().begin < q.sent)
+        {
+            p = i; // atomic write partially sent
+            finishing = true;
+            break;
+        }
+    }
+    while (p > 0 && writeQueues[p].buffer.isEmpty())
+        --p;
+
+    WriteQueue &q = writeQueues[p];
+    if (q.buffer.isEmpty())
+        return;
+
+    if (!_noDelay && !finishing && p == int(Priority::Normal) && q.buffer.size() < PACKET_SIZE && q.sent >= flushOffset)
+    {
+        const qint64 age = (clock.nsecsElapsed() - q.writes.head().queuedAt) / 1000;
+        if (age < _flushDeadline)
+        {
+            if (!flushTimer.isActive())
+                flushTimer.start(int((_flushDeadline - age + 999) / 1000));
+            return;
+        }
+    }
+    flushTimer.stop();
+
+    const QByteArray buffer = q.buffer.take(PACKET_SIZE);
+    poolFit(0); // return drained blocks
+    writeCharacteristic(QVSPTraceRecorder::Characteristic::RxFifo, buffer);
+    q.sent += buffer.size();
+    inFlight.enqueue(qMakePair(p, buffer.size()));
+    ++stats.packetsSent;
+    stats.bytesSent += quint64(buffer.size());
+
+    ++packetsQueued;
+
+    const qint64 now = clock.nsecsElapsed();
+    while (!q.writes.isEmpty() && q.writes.head().end <= q.sent)
+    {
+        const qint64 queuedAt = q.writes.dequeue().queuedAt;
+        const qint64 latency = now - queuedAt;
+        ackPending.enqueue({ packetsQueued, queuedAt });
+        ++q.latency.count;
+        q.latency.last = latency;
+        q.latency.max = qMax(q.latency.max, latency);
+        q.latency.total += latency;
+    }
+
+    emit bytesWritten(buffer.size());
+}
+
+/*!
+ * \brief VSPSocket::queueWrite Appends data to the write queue of a priority
+ * class and tries to send it
+ * \param segments buffers to be written in order
+ * \param count number of buffers
+ * \param priority priority class
+ * \param atomic true if the data must not be interleaved with other classes
+ * \return number of bytes queued, or -1 on error
+ */
+qint64 QVSPSocket::queueWrite(const QByteArray *segments, int count, Priority priority, bool atomic)
+{
+    if (!isOpen())
+    {
+        this->setErrorString(tr("Cannot write while not connected"));
+        emit error(_error = QLowEnergyService::ServiceError::OperationError);
+        return -1;
+    }
+
+    // check for eventual CTS variation
+    processEvents("processEvents (write)");
+
+    WriteQueue &q = writeQueues[int(priority)];
+
+    qint64 len = 0;
+    for (int i = 0; i < count; ++i)
+        len += segments[i].size();
+
+    const int staged = priority == Priority::Normal ? compressInput.size() : 0;
+    if (qint64(q.buffer.size()) + staged + len + 1 > maxWriteBufferSize) {
+        ++stats.writeOverflows;
+        this->setErrorString(tr("Internal write buffer overflow (max. size %1), write failed").arg(maxWriteBufferSize));
+        emit error(_error = QLowEnergyService::ServiceError::OperationError);
+        return -1;
+    }
+    if (!poolFit(len)) {
+        ++stats.writeOverflows;
+        this->setErrorString(tr("Buffer pool exhausted, write failed"));
+        emit error(_error = QLowEnergyService::ServiceError::OperationError);
+        return -1;
+    }
+
+    if (_compression != Compression::None)
+    {
+        compressWrite(segments, count, priority);
+        poolFit(0); // the compressed size differs
+    }
+    else
+        enqueue(q, segments, count, atomic);
+    stats.peakWriteBuffer = qMax(stats.peakWriteBuffer, bytesToWrite());
+
+    writeInternal(); // try to write immediately, otherwise after CTS is set
+    return len;
+}
+
+int QVSPSocket::SegmentQueue::size() const
+{
+    return bytes;
+}
+
+bool QVSPSocket::SegmentQueue::isEmpty() const
+{
+    return bytes == 0;
+}
+
+/*!
+ * \brief VSPSocket::SegmentQueue::append Queues a buffer
+ *
+ * Buffers owning their data are queued by reference. Small buffers and those
+ * borrowing their data (QByteArray::fromRawData(), which have no capacity)
+ * are copied, into the tail segment if that is a copy already.
+ */
+void QVSPSocket::SegmentQueue::append(const QByteArray &segment)
+{
+    const int n = segment.size();
+    if (n == 0)
+        return;
+    bytes += n;
+
+    if (n >= MIN_SHARED_SEGMENT && segment.capacity() >= n)
+    {
+        segments.enqueue(segment);
+        tailCopied = false;
+    }
+    else if (tailCopied)
+        segments.last().append(segment.constData(), n);
+    else
+    {
+        segments.enqueue(QByteArray(segment.constData(), n));
+        tailCopied = true;
+    }
+}
+
+/*!
+ * \brief VSPSocket::SegmentQueue::take Removes data from the front
+ * \param len maximum number of bytes
+ * \return the data, assembled with a single copy, or the head segment itself
+ * if it is taken as a whole
+ */
+QByteArray QVSPSocket::SegmentQueue::take(int len)
+{
+    len = qMin(len, bytes);
+    if (len == 0)
+        return QByteArray();
+    bytes -= len;
+
+    if (offset == 0 && segments.head().size() == len)
+    {
+        if (segments.size() == 1)
+            tailCopied = false;
+        return segments.dequeue();
+    }
+
+    QByteArray packet(len, Qt::Uninitialized);
+    char *out = packet.data();
+    for (int n = 0; n < len; )
+    {
+        const QByteArray &head = segments.head();
+        const int chunk = qMin(len - n, head.size() - offset);
+        memcpy(out + n, head.constData() + offset, size_t(chunk));
+        n += chunk;
+        offset += chunk;
+        if (offset == head.size())
+        {
+            if (segments.size() == 1)
+                tailCopied = false;
+            segments.dequeue();
+            offset = 0;
+        }
+    }
+    return packet;
+}
+
+void QVSPSocket::SegmentQueue::clear()
+{
+    segments.clear();
+    offset = 0;
+    bytes = 0;
+    tailCopied = false;
+}
+
+void QVSPSocket::enqueue(WriteQueue &q, const QByteArray *segments, int count, bool atomic)
+{
+    qint64 len = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        q.buffer.append(segments[i]);
+        len += segments[i].size();
+    }
+    q.writes.enqueue({ q.queued, q.queued + len, clock.nsecsElapsed(), atomic });
+    q.queued += len;
+}
+
+/*!
+ * \brief VSPSocket::compressWrite Passes written data through the compressor
+ * \param segments buffers to be written in order
+ * \param count number of buffers
+ * \param priority priority class
+ *
+ * With CompressionFlush::FullBlock normal priority data is staged until a
+ * block is full, flush() is called or the flush deadline expires. All other
+ * data is compressed right away.
+ */
+void QVSPSocket::compressWrite(const QByteArray *segments, int count, Priority priority)
+{
+    if (priority != Priority::Normal || _compressionFlush == CompressionFlush::EveryWrite)
+    {
+        if (count == 1)
+        {
+            compressBlocks(segments[0].constData(), segments[0].size(), priority);
+            return;
+        }
+        QByteArray joined;
+        for (int i = 0; i < count; ++i)
+            joined.append(segments[i]);
+        compressBlocks(joined.constData(), joined.size(), priority);
+        return;
+    }
+
+    for (int i = 0; i < count; ++i)
+        compressInput.append(segments[i]);
+
+    const int full = compressInput.size() - compressInput.size() % _compressionBlockSize;
+    if (full > 0)
+    {
+        compressBlocks(compressInput.constData(), full, priority);
+        compressInput.remove(0, full);
+    }
+
+    if (compressInput.isEmpty())
+        compressTimer.stop();
+    else if (!compressTimer.isActive())
+        compressTimer.start((_flushDeadline + 999) / 1000);
+}
+
+/*!
+ * \brief VSPSocket::compressBlocks Compresses data into independent blocks
+ * and queues them
+ * \param data data to be compressed
+ * \param len data length
+ * \param priority priority class
+ *
+ * Each block carries a 2 byte big endian header: the high bit marks a block
+ * stored uncompressed, the remaining bits hold the payload length. Blocks do
+ * not share a window, so blocks of different priority classes may overtake
+ * each other. Blocks are queued atomically.
+ */
+void QVSPSocket::compressBlocks(const char *data, int len, Priority priority)
+{
+    WriteQueue &q = writeQueues[int(priority)];
+    const qint64 start = clock.nsecsElapsed();
+
+    for (int pos = 0; pos < len; pos += _compressionBlockSize)
+    {
+        const int n = qMin(_compressionBlockSize, len - pos);
+        QByteArray block(BLOCK_HEADER_SIZE, 0);
+        QVSPHeatshrinkCodec::compress(data + pos, n, block);
+
+        quint16 header = quint16(block.size() - BLOCK_HEADER_SIZE);
+        if (header >= n)
+        {
+            // incompressible, store as is
+            block.resize(BLOCK_HEADER_SIZE);
+            block.append(data + pos, n);
+            header = quint16(BLOCK_STORED | n);
+            ++compressionTotals.storedBlocks;
+        }
+        block[0] = char(header >> 8);
+        block[1] = char(header);
+
+        compressionTotals.bytesOut += quint64(block.size());
+        enqueue(q, &block, 1, true);
+    }
+
+    compressionTotals.bytesIn += quint64(len);
+    compressionTotals.compressTime += clock.nsecsElapsed() - start;
+}
+
+/*!
+ * \brief VSPSocket::compressStaged Compresses and queues the staged partial
+ * block
+ */
+void QVSPSocket::compressStaged()
+{
+    compressTimer.stop();
+    if (compressInput.isEmpty())
+        return;
+
+    compressBlocks(compressInput.constData(), compressInput.size(), Priority::Normal);
+    compressInput.clear();
+}
+
+/*!
+ * \brief VSPSocket::decompressReceived Reassembles and expands compressed
+ * blocks notified on the TX FIFO characteristic
+ * \param data packet payload
+ *
+ * The expanded data is passed on to dataReceived(). A malformed block is
+ * skipped and reported as error. A block header announcing more than a
+ * block can hold, or more than fits the read buffer, is reported as error
+ * and the partial input is discarded, as the block boundaries are lost then.
+ */
+void QVSPSocket::decompressReceived(const QByteArray &data)
+{
+    const qint64 start = clock.nsecsElapsed();
+    compressionTotals.bytesReceived += quint64(data.size());
+    decompressInput.append(data);
+
+    QByteArray expanded;
+    int pos = 0;
+    while (decompressInput.size() - pos >= BLOCK_HEADER_SIZE)
     {
-        QBuffer buff(&writeBuffer);
-        buff.open(QIODevice::ReadOnly);
-        auto buffer = buff.read(PACKET_SIZE);
-        buff.close();
-        if (!buffer.isEmpty())
+        const quint16 header = quint16(uchar(decompressInput.at(pos)) << 8 | uchar(decompressInput.at(pos + 1)));
+        const int n = header & ~BLOCK_STORED;
+        if (n == 0 || n > MAX_COMPRESSION_BLOCK || qint64(BLOCK_HEADER_SIZE) + n + PACKET_SIZE + 1 > maxBufferSize)
         {
-            service->writeCharacteristic(rxFifoChar, buffer);
-            emit bytesWritten(buffer.size());
-            writeBuffer.remove(0, buffer.size());
+            pos = decompressInput.size();
+            setError(QLowEnergyService::ServiceError::CharacteristicReadError,
+                     tr("Invalid compressed block header (length %1), received data dropped").arg(n));
+            break;
         }
+        if (decompressInput.size() - pos - BLOCK_HEADER_SIZE < n)
+            break; // block incomplete
+
+        const char *block = decompressInput.constData() + pos + BLOCK_HEADER_SIZE;
+        pos += BLOCK_HEADER_SIZE + n;
+
+        if (header & BLOCK_STORED)
+            expanded.append(block, n);
+        else if (!QVSPHeatshrinkCodec::decompress(block, n, expanded, MAX_COMPRESSION_BLOCK))
+            setError(QLowEnergyService::ServiceError::CharacteristicReadError, tr("Malformed compressed block dropped"));
+    }
+    decompressInput.remove(0, pos);
+
+    compressionTotals.bytesExpanded += quint64(expanded.size());
+    compressionTotals.decompressTime += clock.nsecsElapsed() - start;
+
+    if (!expanded.isEmpty())
+        dataReceived(expanded);
+    else if (readBufferFull())
+        // a partial block fills the buffer
+        updateRTS(false); // RTS clear
+}
+
+/*!
+ * \brief VSPSocket::readBufferFull Tells whether the read buffer, together
+ * with a partially received compressed block, cannot take another packet
+ */
+bool QVSPSocket::readBufferFull() const
+{
+    return qint64(readBuffer.size()) + decompressInput.size() + PACKET_SIZE + 1 > maxBufferSize;
+}
+
+/*!
+ * \brief VSPSocket::updateRTS Requests a change of the RTS modem line
+ * \param set true to set RTS, false to clear it
+ *
+ * At most one RTS write is in flight at any time. Transitions requested while
+ * a write is pending are coalesced: once the device acknowledges the pending
+ * write, a single further write is issued only if the last requested state
+ * differs from the confirmed one.
+ */
+void QVSPSocket::updateRTS(bool set)
+{
+    rtsDesired = set;
+    if ((service == nullptr && replay == nullptr) || rtsInFlight || rtsDesired == rts)
+        return;
+
+    rtsInFlight = true;
+    ++(rtsDesired ? stats.rtsSetWrites : stats.rtsClearWrites);
+    writeCharacteristic(QVSPTraceRecorder::Characteristic::ModemIn, rtsDesired ? MODEM_SET_BIT[m] : MODEM_CLEAR_BIT[m]);
+}
+
+/*!
+ * \brief VSPSocket::updateCTS Records a change of the CTS modem line
+ * \param set true if the device set CTS
+ */
+void QVSPSocket::updateCTS(bool set)
+{
+    const qint64 now = clock.nsecsElapsed();
+    if (cts && !set)
+    {
+        ++stats.ctsStalls;
+        ctsClearedAt = now;
+    }
+    else if (set && ctsClearedAt >= 0)
+    {
+        stats.ctsStallTime += now - ctsClearedAt;
+        histograms[int(Latency::CtsStall)].record(now - ctsClearedAt);
+        ctsClearedAt = -1;
+    }
+
+    const bool changed = cts != set;
+    cts = set;
+    trace(QVSPTraceRecorder::Event::Cts, cts);
+    if (changed)
+        emit clearToSendChanged(cts);
+}
+
+/*!
+ * \brief VSPSocket::dataReceived Handles a data packet notified on the TX FIFO
+ * characteristic
+ * \param data packet payload
+ *
+ * The default implementation appends \a data to the read buffer, applies the
+ * RTS flow control and emits readyRead(). Subclasses may override it to
+ * process incoming packets directly, bypassing the read buffer.
+ */
+void QVSPSocket::dataReceived(const QByteArray &data)
+{
+    if (qint64(readBuffer.size()) + data.size() + 1 > maxBufferSize)
+    {
+        // there is no space left, should not happen due to data loss
+        updateRTS(false); // RTS clear
+        ++stats.readOverflows;
+        this->setErrorString(tr("Internal read buffer overflow (max. size %1), data packet dropped").arg(maxBufferSize));
+        emit error(_error = QLowEnergyService::ServiceError::CharacteristicReadError);
+        return;
+    }
+
+    readBuffer.append(data);
+    readAppended += data.size();
+    arrivals.enqueue({ readAppended, notifiedAt });
+    stats.peakReadBuffer = qMax(stats.peakReadBuffer, qint64(readBuffer.size()));
+
+    if (readBufferFull())
+        // okay, now the buffer has become full
+        updateRTS(false); // RTS clear
+    else if (!poolFit(0))
+    {
+        // the buffer pool cannot take another packet, resumed on its release
+        poolStarved = true;
+        updateRTS(false); // RTS clear
     }
+    poolFit(0); // no headroom once RTS is cleared
+
+    if (isOpen())
+    {
+        ++stats.readyReadEmitted;
+        emit readyRead(); // readyRead() emitted only after the handshake completed
+        wakeWaiters(Waiter::Reason::Data);
+    }
+}
+
+/*!
+ * \brief VSPSocket::writeSegments Queues several buffers as one contiguous write
+ * \param segments buffers to be written in order
+ * \param count number of buffers
+ * \param priority priority class
+ * \return number of bytes queued, or -1 on error
+ *
+ * The segments are appended to the write buffer directly, without building an
+ * intermediate concatenation. Either all segments are queued or none, and
+ * they are never interleaved with data of another priority class.
+ */
+qint64 QVSPSocket::writeSegments(const QByteArray *segments, int count, Priority priority)
+{
+    return queueWrite(segments, count, priority, true);
+}
+
+qint64 QVSPSocket::writeSegments(std::initializer_list<QByteArray> segments, Priority priority)
+{
+    return queueWrite(segments.begin(), int(segments.size()), priority, true);
+}
+
+/*!
+ * \brief VSPSocket::writev Writes several buffers as one contiguous write
+ * \param segments buffers to be written in order, e.g. header, payload and
+ * trailer
+ * \param priority priority class
+ * \return number of bytes queued, or -1 on error
+ *
+ * The buffers are queued by reference (implicitly shared) and packets are
+ * assembled from them at send time, so the data is copied once, into the
+ * outgoing packet. Buffers below 64 byte or created by
+ * QByteArray::fromRawData() are copied when queued. Either all segments are
+ * queued or none, and they are never interleaved with data of another
+ * priority class.
+ */
+qint64 QVSPSocket::writev(const QList<QByteArray> &segments, Priority priority)
+{
+    QVarLengthArray<QByteArray, 16> array;
+    for (const QByteArray &segment: segments)
+        array.append(segment);
+    return queueWrite(array.constData(), array.size(), priority, true);
+}
+
+qint64 QVSPSocket::writev(std::initializer_list<QByteArray> segments, Priority priority)
+{
+    return queueWrite(segments.begin(), int(segments.size()), priority, true);
+}
+
+/*!
+ * \brief VSPSocket::setError Records an error and emits error()
+ * \param error error code
+ * \param errorString human readable description
+ */
+void QVSPSocket::setError(QLowEnergyService::ServiceError error, const QString &errorString)
+{
+    setErrorString(errorString);
+    emit this->error(_error = error);
 }
 
 /*!
@@ -189,6 +743,7 @@ void QVSPSocket::connectToDevice(const QBluetoothDeviceInfo& remoteDeviceInfo)
         emit error(_error = QLowEnergyService::ServiceError::OperationError);
     });
     connect(controller.data(), &QLowEnergyController::connected, [this]() {
+        handshakePhase("discover services");
         controller->discoverServices();
     });
     connect(controller.data(), &QLowEnergyController::discoveryFinished, [this]() {
@@ -237,6 +792,15 @@ void QVSPSocket::connectToDevice(const QBluetoothDeviceInfo& remoteDeviceInfo)
             default:
                 break;
             }
+            if (error == QLowEnergyService::ServiceError::CharacteristicWriteError && !writesInFlight.isEmpty())
+            {
+                // responses arrive in the order of the writes
+                const QVSPTraceRecorder::Characteristic id = writesInFlight.dequeue();
+                if (id == QVSPTraceRecorder::Characteristic::ModemIn)
+                    rtsInFlight = false; // allow a retry
+                else if (id == QVSPTraceRecorder::Characteristic::RxFifo)
+                    writeFailed();
+            }
             emit this->error(_error = error);
             return;
         });
@@ -279,39 +843,17 @@ void QVSPSocket::connectToDevice(const QBluetoothDeviceInfo& remoteDeviceInfo)
 
             connect(service, &QLowEnergyService::descriptorWritten, [this](const QLowEnergyDescriptor &descriptor, const QByteArray &newValue) {
                 if (descriptor == txFifoNotify && newValue == DESC_NOTIFY_ON)
-                    service->writeDescriptor(modemOutNotify, DESC_NOTIFY_ON); // enable notify on CTS
+                    writeDescriptor(QVSPTraceRecorder::Characteristic::ModemOut, DESC_NOTIFY_ON); // enable notify on CTS
                 else if (descriptor == modemOutNotify && newValue == DESC_NOTIFY_ON)
-                    service->writeCharacteristic(modemInChar, MODEM_SET_BIT[m]); // RTS set
+                {
+                    handshakePhase("set RTS");
+                    updateRTS(true); // RTS set
+                }
             });
 
             connect(service, &QLowEnergyService::characteristicChanged, [this](const QLowEnergyCharacteristic &info, const QByteArray &newValue) {
                 qDebug() << QByteArrayLiteral("VSP characteristic changed: ") << info.uuid() << QByteArrayLiteral(" new value: ") << newValue;
-
-                if (info == txFifoChar)
-                {
-                    if (qint64(readBuffer.size()) + newValue.size() + 1 > maxBufferSize)
-                    {
-                        // there is no space left, should not happen due to data loss
-                        service->writeCharacteristic(modemInChar, MODEM_CLEAR_BIT[m]); // RTS clear
-                        this->setErrorString(tr("Internal read buffer overflow (max. size %1), data packet dropped").arg(maxBufferSize));
-                        emit error(_error = QLowEnergyService::ServiceError::CharacteristicReadError);
-                        return;
-                    }
-
-                    readBuffer.append(newValue);
-
-                    if (qint64(readBuffer.size()) + PACKET_SIZE + 1 > maxBufferSize)
-                        // okay, now the buffer has become full
-                        service->writeCharacteristic(modemInChar, MODEM_CLEAR_BIT[m]); // RTS clear
-
-                    if (isOpen())
-                        emit readyRead(); // readyRead() emitted only after the handshake completed
-                }
-                else if (info == modemOutChar)
-                {
-                    cts = newValue == MODEM_SET_BIT[m];
-                    writeInternal(); // CTS set, now write
-                }
+                characteristicChanged(traceId(info), newValue);
             });
 
             connect(service, &QLowEnergyService::characteristicRead, [this](const QLowEnergyCharacteristic &info, const QByteArray &value) {
@@ -319,47 +861,43 @@ void QVSPSocket::connectToDevice(const QBluetoothDeviceInfo& remoteDeviceInfo)
 
                 if (info == modemOutChar && !isOpen())
                 {
-                    cts = value == MODEM_SET_BIT[m];
+                    handshakePhase(nullptr);
+                    updateCTS(value == MODEM_SET_BIT[m]);
 
                     // now finally ready to accept
-                    QIODevice::open(OpenModeFlag::ReadWrite);
+                    QIODevice::open(OpenModeFlag::ReadWrite | OpenModeFlag::Unbuffered);
 
                     emit stateChanged(_state = QBluetoothSocket::SocketState::ConnectedState);
                     emit connected();
 
                     if (!readBuffer.isEmpty())
+                    {
+                        ++stats.readyReadEmitted;
                         emit readyRead(); // there might be data left from the handshake
+                    }
                 }
             });
 
             connect(service, &QLowEnergyService::characteristicWritten, [this](const QLowEnergyCharacteristic &info, const QByteArray &value) {
                 qDebug() << QByteArrayLiteral("VSP characteristic written: ") << info.uuid() << QByteArrayLiteral(" value: ") << value;
-
-                if (info == rxFifoChar)
-                    writeInternal();
-                else if (info == modemInChar)
-                {
-                    rts = value == MODEM_SET_BIT[m];
-                    if (rts && !isOpen())
-                        // first RTS written, now read CTS (we could have missed its notification)
-                        service->readCharacteristic(modemOutChar);
-                }
-                else if (info == brspModeChar)
-                    // BlueRadios changed into data mode, now proceed as usual
-                    service->writeDescriptor(txFifoNotify, DESC_NOTIFY_ON); // enable notify on TX buffer
+                characteristicWritten(traceId(info), value);
             });
 
+            handshakePhase("enable notifications");
+
             // BlueRadios
             if (m == Manufacturer::BlueRadios)
                 // BlueRadios needs to be changed into data mode first
-                service->writeCharacteristic(brspModeChar, BRSP_MODE_DATA);
+                writeCharacteristic(QVSPTraceRecorder::Characteristic::BrspMode, BRSP_MODE_DATA);
             else
-                service->writeDescriptor(txFifoNotify, DESC_NOTIFY_ON); // enable notify on TX buffer
+                writeDescriptor(QVSPTraceRecorder::Characteristic::TxFifo, DESC_NOTIFY_ON); // enable notify on TX buffer
         });
 
+        handshakePhase("discover details");
         service->discoverDetails();
     });
 
+    handshakePhase("connect");
     controller->connectToDevice();
     emit stateChanged(_state = QBluetoothSocket::SocketState::ConnectingState);
 }
@@ -384,16 +922,51 @@ void QVSPSocket::close()
     emit stateChanged(_state = QBluetoothSocket::SocketState::ClosingState);
     emit readChannelFinished();
 
-    controller->disconnectFromDevice();
+    if (!controller.isNull())
+        controller->disconnectFromDevice();
     QIODevice::close();
 
     // re-init
+    handshakePhase(nullptr); // a handshake might have been interrupted
     controller.reset();
     service = nullptr;
+    replay = nullptr;
+    if (ctsClearedAt >= 0)
+        stats.ctsStallTime += clock.nsecsElapsed() - ctsClearedAt; // end an ongoing stall
+    ctsClearedAt = -1;
     cts = false;
     rts = false;
+    rtsDesired = false;
+    rtsInFlight = false;
     readBuffer.clear();
-    writeBuffer.clear();
+    ackPending.clear();
+    inFlight.clear();
+    writesInFlight.clear();
+    packetsQueued = 0;
+    packetsAcked = 0;
+    arrivals.clear();
+    readAppended = 0;
+    readConsumed = 0;
+    failFutures();
+    for (WriteQueue &q: writeQueues)
+    {
+        q.buffer.clear();
+        q.writes.clear();
+        q.queued = 0;
+        q.sent = 0;
+        q.acked = 0;
+        q.lostBegin = 0;
+        q.lostEnd = 0;
+    }
+    flushOffset = 0;
+    flushTimer.stop();
+    compressInput.clear();
+    decompressInput.clear();
+    compressTimer.stop();
+    if (transfer.source != nullptr)
+        endFileTransfer();
+    poolFit(0); // returns all blocks
+    poolStarved = false;
 
     emit stateChanged(_state = QBluetoothSocket::SocketState::UnconnectedState);
     emit disconnected();
@@ -411,78 +984,1426 @@ qint64 QVSPSocket::bytesAvailable() const
 
 qint64 QVSPSocket::bytesToWrite() const
 {
-    return writeBuffer.size();
+    qint64 size = compressInput.size();
+    for (const WriteQueue &q: writeQueues)
+        size += q.buffer.size();
+    return size;
 }
 
-bool QVSPSocket::canReadLine() const
+/*!
+ * \brief VSPSocket::bytesToWrite Returns the number of bytes waiting in the
+ * write queue of a priority class
+ */
+qint64 QVSPSocket::bytesToWrite(Priority priority) const
 {
-    return QIODevice::canReadLine() || readBuffer.contains('\n');
+    if (priority == Priority::Normal)
+        return writeQueues[int(priority)].buffer.size() + compressInput.size();
+    return writeQueues[int(priority)].buffer.size();
 }
 
 /*!
- * \brief VSPSocket::state Returns the current state of the socket
- * \return current state
+ * \brief VSPSocket::writeRoom Returns how many bytes a write of a priority
+ * class can currently queue
+ *
+ * Accounts for the write buffer limit, data staged for compression and the
+ * buffer pool, like write() does.
  */
-QBluetoothSocket::SocketState QVSPSocket::state() const
+qint64 QVSPSocket::writeRoom(Priority priority) const
 {
-    return _state;
+    return qMax<qint64>(0, qMin(maxWriteBufferSize - 1 - bytesToWrite(priority), poolRoom()));
 }
 
 /*!
- * \brief VSPSocket::error Returns the last error
- * \return last error
+ * \brief VSPSocket::isClearToSend Returns the CTS modem line as last notified
+ * by the device
  */
-QLowEnergyService::ServiceError QVSPSocket::error() const
+bool QVSPSocket::isClearToSend() const
 {
-    return _error;
+    return cts;
 }
 
-qint64 QVSPSocket::readData(char *data, qint64 maxlen)
+/*!
+ * \brief VSPSocket::write Writes data with a given priority
+ * \param data data to be written
+ * \param priority priority class
+ * \return number of bytes queued, or -1 on error
+ *
+ * Pending data of a higher priority class is always sent first, at packet
+ * granularity, so that e.g. a stop command overtakes a queued upload. The
+ * classes are interleaved in the byte stream, hence the peer has to be able
+ * to tell them apart. Each class has its own write buffer of the maximum
+ * buffer size. write() without priority uses Priority::Normal.
+ *
+ * \sa writeLatency()
+ */
+qint64 QVSPSocket::write(const QByteArray &data, Priority priority)
 {
-    if (!isOpen())
-    {
-        this->setErrorString(tr("Cannot read while not connected"));
-        emit error(_error = QLowEnergyService::ServiceError::OperationError);
-        return -1;
+    return queueWrite(&data, 1, priority, false); // by reference, unlike QIODevice::write()
+}
+
+/*!
+ * \brief VSPSocket::writeAsync Writes data and reports when the device has
+ * received it
+ * \param data data to be written
+ * \param priority priority class
+ * \return future resolving to the number of bytes written once the device
+ * acknowledged the last packet of the data, or to -1 if the write failed,
+ * a packet carrying the data failed, the data was discarded or the
+ * connection was closed
+ *
+ * Unlike write(), which completes when the data is queued, this allows to
+ * pipeline request/response protocols: the next request can be queued right
+ * away and the response matched to a request known to have arrived. The
+ * pending futures of a class are kept in a queue ordered by stream offset, so
+ * each acknowledgement resolves them in constant time. With compression a
+ * partial block is flushed, as it would never be acknowledged otherwise.
+ */
+QFuture<qint64> QVSPSocket::writeAsync(const QByteArray &data, Priority priority)
+{
+    QFutureInterface<qint64> promise;
+    promise.reportStarted();
+
+    WriteQueue &q = writeQueues[int(priority)];
+    const qint64 begin = q.queued;
+    qint64 result = write(data, priority);
+    if (result >= 0 && priority == Priority::Normal && !compressInput.isEmpty())
+    {
+        compressStaged();
+        writeInternal();
+    }
+    if (result < 0 || q.acked >= q.queued)
+    {
+        promise.reportFinished(&result);
+        return promise.future();
+    }
+
+    q.futures.enqueue({ begin, q.queued, result, promise });
+    return promise.future();
+}
+
+/*!
+ * \brief VSPSocket::failFutures Resolves all pending writeAsync() futures to -1
+ */
+void QVSPSocket::failFutures()
+{
+    const qint64 failed = -1;
+    for (WriteQueue &q: writeQueues)
+    {
+        while (!q.futures.isEmpty())
+            q.futures.dequeue().promise.reportFinished(&failed);
+    }
+}
+
+/*!
+ * \brief VSPSocket::failFutures Resolves the pending writeAsync() futures of a
+ * priority class covering a stream range to -1
+ */
+void QVSPSocket::failFutures(WriteQueue &q, qint64 begin, qint64 end)
+{
+    const qint64 failed = -1;
+    for (auto it = q.futures.begin(); it != q.futures.end(); )
+    {
+        if (it->begin < end && it->end > begin)
+        {
+            it->promise.reportFinished(&failed);
+            it = q.futures.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+/*!
+ * \brief VSPSocket::writeLatency Returns the queueing latency of a priority
+ * class
+ * \return time from queueing a write to its last byte being passed to the
+ * link, in ns
+ */
+QVSPSocket::WriteLatency QVSPSocket::writeLatency(Priority priority) const
+{
+    return writeQueues[int(priority)].latency;
+}
+
+/*!
+ * \brief VSPSocket::statistics Returns a snapshot of the socket statistics
+ *
+ * The counters are plain members updated by the socket handlers, so the
+ * snapshot is a copy without any locking; call it from the socket's thread.
+ * They accumulate across connections until resetStatistics() is called.
+ */
+QVSPSocket::Statistics QVSPSocket::statistics() const
+{
+    Statistics snapshot = stats;
+    if (ctsClearedAt >= 0)
+        snapshot.ctsStallTime += clock.nsecsElapsed() - ctsClearedAt;
+    return snapshot;
+}
+
+void QVSPSocket::resetStatistics()
+{
+    stats = Statistics();
+    if (ctsClearedAt >= 0)
+        ctsClearedAt = clock.nsecsElapsed();
+}
+
+/*!
+ * \brief VSPSocket::latencyHistogram Returns a snapshot of a latency histogram
+ * \param latency measured interval
+ * \return histogram of the interval in ns
+ *
+ * WriteAcknowledge spans from queueing a write (or, with compression, its
+ * block) to the device acknowledging the packet carrying its last byte.
+ * NotificationRead spans from a TX FIFO notification to its last byte being
+ * taken from the read buffer by readData(); it is not recorded when a
+ * subclass processes packets in dataReceived() itself. The histograms
+ * accumulate across connections until resetLatencyHistograms() is called.
+ *
+ * \sa QVSPHistogram::percentile()
+ */
+QVSPHistogram QVSPSocket::latencyHistogram(Latency latency) const
+{
+    return histograms[int(latency)];
+}
+
+void QVSPSocket::resetLatencyHistograms()
+{
+    for (QVSPHistogram &histogram: histograms)
+        histogram.reset();
+}
+
+/*!
+ * \brief VSPSocket::flush Sends data held back for coalescing without waiting
+ * for the flush deadline
+ * \return true if any data has been passed to the link
+ *
+ * Only a packet at a time may be in flight, the remaining data follows as soon
+ * as the device accepts it.
+ *
+ * \sa setNoDelay()
+ */
+bool QVSPSocket::flush()
+{
+    compressStaged();
+    flushOffset = writeQueues[int(Priority::Normal)].queued;
+
+    qint64 sent = 0;
+    for (const WriteQueue &q: writeQueues)
+        sent += q.sent;
+    writeInternal();
+    for (const WriteQueue &q: writeQueues)
+        sent -= q.sent;
+    return sent != 0;
+}
+
+bool QVSPSocket::noDelay() const
+{
+    return _noDelay;
+}
+
+/*!
+ * \brief VSPSocket::setNoDelay Enables or disables write coalescing
+ * \param noDelay true (default) to send pending data immediately, false to
+ * hold back partial packets
+ *
+ * Like TCP_NODELAY: applications writing a few bytes at a time waste a
+ * connection event per small packet. With coalescing, normal priority data is
+ * sent only in full packets, until flush() is called or the oldest pending
+ * byte reaches the flush deadline. High priority data is never held back.
+ *
+ * \sa setFlushDeadline()
+ */
+void QVSPSocket::setNoDelay(bool noDelay)
+{
+    _noDelay = noDelay;
+    if (_noDelay && isOpen())
+        writeInternal();
+}
+
+int QVSPSocket::flushDeadline() const
+{
+    return _flushDeadline;
+}
+
+/*!
+ * \brief VSPSocket::setFlushDeadline Sets how long a partial packet may be
+ * held back when coalescing
+ * \param usecs 0 .. INT_MAX microseconds (default 10000), resolved with
+ * millisecond timer precision
+ */
+void QVSPSocket::setFlushDeadline(int usecs)
+{
+    _flushDeadline = qMax(0, usecs);
+}
+
+QVSPSocket::Compression QVSPSocket::compression() const
+{
+    return _compression;
+}
+
+/*!
+ * \brief VSPSocket::setCompression Selects the compression of the link
+ * \param compression compression, the peer has to use the same one
+ *
+ * Written data is compressed in independent blocks of at most
+ * compressionBlockSize() byte with the heatshrink bit stream (see
+ * QVSPHeatshrinkCodec), which is cheap enough to be expanded by small
+ * embedded peers; received data is expected in the same format. The VSP
+ * service offers no option negotiation, so the setting has to be agreed by
+ * the application protocol and can only be changed while not connected.
+ *
+ * RTS flow control accounts for expanded data, hence leave some read buffer
+ * headroom for a block expanding beyond one packet.
+ *
+ * \sa setCompressionFlush(), compressionCounters()
+ */
+void QVSPSocket::setCompression(Compression compression)
+{
+    if (isOpen())
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("Cannot change the compression while connected"));
+        return;
+    }
+    _compression = compression;
+}
+
+QVSPSocket::CompressionFlush QVSPSocket::compressionFlush() const
+{
+    return _compressionFlush;
+}
+
+/*!
+ * \brief VSPSocket::setCompressionFlush Sets when written data is compressed
+ * \param compressionFlush EveryWrite (default) compresses each write on its
+ * own; FullBlock stages normal priority data until a block is full, flush() is
+ * called or the flush deadline expires, giving a better ratio for small writes
+ *
+ * \sa setFlushDeadline()
+ */
+void QVSPSocket::setCompressionFlush(CompressionFlush compressionFlush)
+{
+    _compressionFlush = compressionFlush;
+    if (_compressionFlush == CompressionFlush::EveryWrite && isOpen())
+    {
+        compressStaged();
+        writeInternal();
+    }
+}
+
+int QVSPSocket::compressionBlockSize() const
+{
+    return _compressionBlockSize;
+}
+
+/*!
+ * \brief VSPSocket::setCompressionBlockSize Sets the maximum uncompressed size
+ * of one block
+ * \param compressionBlockSize 1 .. 4096 (default 512), the peer has to be able
+ * to expand blocks of this size
+ */
+void QVSPSocket::setCompressionBlockSize(int compressionBlockSize)
+{
+    _compressionBlockSize = qBound(1, compressionBlockSize, MAX_COMPRESSION_BLOCK);
+}
+
+/*!
+ * \brief VSPSocket::compressionCounters Returns the compression statistics
+ *
+ * The compression ratio is bytesOut / bytesIn, the CPU time per byte
+ * compressTime / bytesIn and decompressTime / bytesExpanded.
+ */
+QVSPSocket::CompressionCounters QVSPSocket::compressionCounters() const
+{
+    return compressionTotals;
+}
+
+void QVSPSocket::resetCompressionCounters()
+{
+    compressionTotals = CompressionCounters();
+}
+
+/*!
+ * \brief VSPSocket::sendFile Streams the content of a device over the link
+ * \param source readable device, read from its current position; it must
+ * stay valid until fileSent() or the transfer is aborted
+ * \return true if the transfer has been started
+ *
+ * Instead of buffering the whole content, the normal priority write queue is
+ * kept filled to a small low watermark and refilled whenever a packet leaves,
+ * so memory use does not depend on the transfer size and maxBufferSize does
+ * not limit it. Files are memory mapped when possible. Sequential sources
+ * are read as data arrives, until they emit readChannelFinished().
+ *
+ * Progress and throughput are reported by fileProgress(), completion by
+ * fileSent() once the last byte has been passed to the link. Other writes
+ * may continue meanwhile, normal priority ones are interleaved with the file
+ * data.
+ */
+bool QVSPSocket::sendFile(QIODevice *source)
+{
+    if (!isOpen())
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("Cannot write while not connected"));
+        return false;
+    }
+    if (transfer.source != nullptr)
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("A file transfer is already in progress"));
+        return false;
+    }
+    if (source == nullptr || !source->isReadable())
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("File transfer source is not readable"));
+        return false;
+    }
+
+    transfer.source = source;
+    transfer.startedAt = clock.nsecsElapsed();
+    if (!source->isSequential())
+    {
+        transfer.size = source->size() - source->pos();
+        QFileDevice *file = qobject_cast<QFileDevice *>(source);
+        if (file != nullptr && transfer.size > 0)
+            transfer.map = file->map(source->pos(), transfer.size); // nullptr: fall back to read()
+    }
+
+    connect(source, &QIODevice::readyRead, this, [this]() {
+        pumpFile();
+    });
+    connect(source, &QIODevice::readChannelFinished, this, [this]() {
+        transfer.sourceFinished = true;
+        pumpFile();
+    });
+
+    pumpFile();
+    return true;
+}
+
+/*!
+ * \brief VSPSocket::sendFile Streams a file over the link
+ * \param path file path
+ * \return true if the transfer has been started
+ *
+ * \sa sendFile(QIODevice*)
+ */
+bool QVSPSocket::sendFile(const QString &path)
+{
+    if (transfer.source != nullptr)
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("A file transfer is already in progress"));
+        return false;
+    }
+
+    transfer.file.reset(new QFile(path));
+    if (!transfer.file->open(QIODevice::ReadOnly))
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("Cannot open %1: %2").arg(path, transfer.file->errorString()));
+        transfer.file.reset();
+        return false;
+    }
+
+    if (!sendFile(transfer.file.data()))
+    {
+        transfer.file.reset();
+        return false;
+    }
+    return true;
+}
+
+bool QVSPSocket::isSendingFile() const
+{
+    return transfer.source != nullptr;
+}
+
+/*!
+ * \brief VSPSocket::abortFileTransfer Stops reading from the file transfer
+ * source
+ *
+ * File data already queued is still sent, fileSent() is not emitted.
+ */
+void QVSPSocket::abortFileTransfer()
+{
+    if (transfer.source != nullptr)
+        endFileTransfer();
+}
+
+/*!
+ * \brief VSPSocket::pumpFile Tops up the write queue from the file transfer
+ * source and detects its completion
+ */
+void QVSPSocket::pumpFile()
+{
+    if (transfer.source == nullptr || transfer.pumping)
+        return;
+    transfer.pumping = true; // writes may process events and re-enter
+
+    // with compression a partial block is staged, keep one block more queued
+    const qint64 watermark = qMin<qint64>(FILE_LOW_WATERMARK + (_compression != Compression::None ? _compressionBlockSize : 0),
+                                          maxWriteBufferSize - 1);
+    const qint64 before = transfer.read;
+
+    while (transfer.end < 0 && isOpen() && bytesToWrite(Priority::Normal) < watermark)
+    {
+        qint64 room = watermark - bytesToWrite(Priority::Normal);
+        if (!poolFit(qMin<qint64>(room, PACKET_SIZE)))
+            break; // buffer pool exhausted, resumed on its release
+        room = qMin(room, poolRoom());
+        QByteArray chunk;
+        if (transfer.map != nullptr)
+        {
+            const qint64 n = qMin(room, transfer.size - transfer.read);
+            chunk = QByteArray::fromRawData(reinterpret_cast<const char *>(transfer.map + transfer.read), int(n));
+        }
+        else
+        {
+            chunk.resize(int(room));
+            const qint64 n = transfer.source->read(chunk.data(), room);
+            if (n < 0)
+            {
+                setError(QLowEnergyService::ServiceError::OperationError,
+                         tr("File transfer read error: %1").arg(transfer.source->errorString()));
+                endFileTransfer();
+                return;
+            }
+            chunk.resize(int(n));
+            if (n == 0 && !(transfer.source->atEnd() && (!transfer.source->isSequential() || transfer.sourceFinished)))
+                break; // wait for readyRead()
+        }
+
+        if (chunk.isEmpty())
+        {
+            // all queued, send a staged partial block right away
+            compressStaged();
+            transfer.end = writeQueues[int(Priority::Normal)].queued;
+            writeInternal();
+            break;
+        }
+
+        if (queueWrite(&chunk, 1, Priority::Normal, false) < 0)
+        {
+            if (transfer.source != nullptr)
+                endFileTransfer();
+            return;
+        }
+        if (transfer.source == nullptr)
+            return; // closed while processing events
+        transfer.read += chunk.size();
+    }
+
+    if (transfer.read != before)
+    {
+        const qint64 elapsed = qMax<qint64>(1, clock.nsecsElapsed() - transfer.startedAt);
+        emit fileProgress(transfer.read, transfer.size, qint64(double(transfer.read) * 1e9 / elapsed));
+    }
+
+    transfer.pumping = false;
+    if (transfer.end >= 0 && writeQueues[int(Priority::Normal)].sent >= transfer.end)
+    {
+        endFileTransfer();
+        emit fileSent();
+    }
+}
+
+void QVSPSocket::endFileTransfer()
+{
+    QFileDevice *file = qobject_cast<QFileDevice *>(transfer.source);
+    if (transfer.map != nullptr && file != nullptr)
+        file->unmap(transfer.map);
+    disconnect(transfer.source, nullptr, this, nullptr);
+
+    transfer.source = nullptr;
+    transfer.file.reset();
+    transfer.map = nullptr;
+    transfer.size = -1;
+    transfer.read = 0;
+    transfer.end = -1;
+    transfer.sourceFinished = false;
+    transfer.pumping = false;
+}
+
+/*!
+ * \brief VSPSocket::startCapture Starts persisting every received packet
+ * \param path capture file, data is appended to an existing file
+ * \param timestamps true to store each packet as a timestamped record
+ * \return true if the capture file has been opened
+ *
+ * The payloads notified on the TX FIFO characteristic are copied as received
+ * (before decompression) into a memory mapped, preallocated capture file, see
+ * QVSPCaptureFile. The data is still put into the read buffer, unless
+ * setCaptureOnly() is enabled.
+ *
+ * The capture survives reconnections until stopCapture() is called.
+ */
+bool QVSPSocket::startCapture(const QString &path, bool timestamps)
+{
+    stopCapture();
+
+    capture.reset(new QVSPCaptureFile(path, timestamps));
+    if (!capture->open())
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("Cannot open %1: %2").arg(path, capture->errorString()));
+        capture.reset();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief VSPSocket::stopCapture Stops capturing and closes the capture file
+ */
+void QVSPSocket::stopCapture()
+{
+    capture.reset();
+}
+
+bool QVSPSocket::isCapturing() const
+{
+    return !capture.isNull();
+}
+
+bool QVSPSocket::captureOnly() const
+{
+    return _captureOnly;
+}
+
+/*!
+ * \brief VSPSocket::setCaptureOnly Bypasses the read buffer while capturing
+ * \param captureOnly true if the received data is only captured
+ *
+ * A logging-only socket then never throttles the device by RTS. Nothing can
+ * be read from the socket while a capture is running.
+ */
+void QVSPSocket::setCaptureOnly(bool captureOnly)
+{
+    _captureOnly = captureOnly;
+}
+
+/*!
+ * \brief VSPSocket::capturedBytes Returns the size of the capture file
+ * \return size in byte, including record headers, or 0 if not capturing
+ */
+qint64 QVSPSocket::capturedBytes() const
+{
+    return capture.isNull() ? 0 : capture->size();
+}
+
+/*!
+ * \brief VSPSocket::startTrace Starts recording a binary trace of the link
+ * \param path trace file, overwritten
+ * \param bufferSize capacity of the in-memory ring
+ * \return true if the trace file has been created
+ *
+ * Every characteristic write, notification, descriptor write, CTS and RTS
+ * change and state transition is recorded with a monotonic timestamp, see
+ * QVSPTraceRecorder for the format. Recording is lock-free and the file is
+ * written by a background thread, so tracing may stay enabled in production.
+ */
+bool QVSPSocket::startTrace(const QString &path, int bufferSize)
+{
+    stopTrace();
+
+    tracer.reset(new QVSPTraceRecorder(path));
+    if (!tracer->open(bufferSize))
+    {
+        setError(QLowEnergyService::ServiceError::OperationError, tr("Cannot open %1: %2").arg(path, tracer->errorString()));
+        tracer.reset();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief VSPSocket::stopTrace Stops tracing, writes the pending events and
+ * closes the trace file
+ */
+void QVSPSocket::stopTrace()
+{
+    tracer.reset();
+}
+
+bool QVSPSocket::isTracing() const
+{
+    return !tracer.isNull();
+}
+
+/*!
+ * \brief VSPSocket::droppedTraceEvents Returns the number of events lost
+ * because the trace writer could not keep up
+ */
+quint32 QVSPSocket::droppedTraceEvents() const
+{
+    return tracer.isNull() ? 0 : tracer->dropped();
+}
+
+/*!
+ * \brief VSPSocket::Waiter::Waiter Creates a waiter for an operation on a
+ * socket
+ *
+ * A waiter is registered with wait() and woken directly from the link
+ * handlers, in the socket's thread, without going through the event loop.
+ * The registration is intrusive, so waiting does not allocate.
+ */
+QVSPSocket::Waiter::Waiter(QVSPSocket &socket)
+    : socket(socket)
+{
+}
+
+QVSPSocket::Waiter::~Waiter()
+{
+    if (waiting)
+        unlink(); // destroyed while suspended
+}
+
+/*!
+ * \brief VSPSocket::Waiter::unlink Unregisters the waiter
+ *
+ * Cursors of running wakeWaiters() calls are moved past it, so that waiters
+ * may be destroyed while others are being resumed.
+ */
+void QVSPSocket::Waiter::unlink()
+{
+    for (Waiter **w = &socket.waiters; *w != nullptr; w = &(*w)->next)
+    {
+        if (*w == this)
+        {
+            *w = next;
+            break;
+        }
+    }
+    for (WakeCursor *c = socket.wakeCursors; c != nullptr; c = c->outer)
+    {
+        if (c->next == this)
+            c->next = next;
+    }
+    next = nullptr;
+    waiting = false;
+}
+
+/*!
+ * \brief VSPSocket::Waiter::wait Registers the waiter until ready() returns
+ * true
+ */
+void QVSPSocket::Waiter::wait()
+{
+    if (waiting)
+        return;
+    waiting = true;
+    next = socket.waiters;
+    socket.waiters = this;
+}
+
+/*!
+ * \fn VSPSocket::Waiter::ready Called when the socket made progress
+ * \param reason kind of progress
+ * \return true if the wait is over, the waiter is unregistered and resumed
+ * then
+ */
+
+/*!
+ * \fn VSPSocket::Waiter::resume Called once the wait is over
+ *
+ * The waiter, and any other waiter, may be destroyed within.
+ */
+
+/*!
+ * \brief VSPSocket::Waiter::indexOf Returns the position of a byte in the
+ * data available for reading, -1 if not found
+ */
+qint64 QVSPSocket::Waiter::indexOf(char delimiter) const
+{
+    return socket.indexOf(delimiter);
+}
+
+/*!
+ * \brief VSPSocket::Waiter::queued Returns the number of bytes ever queued in
+ * a priority class during this connection, the stream offset of the next write
+ */
+qint64 QVSPSocket::Waiter::queued(Priority priority) const
+{
+    return socket.writeQueues[int(priority)].queued;
+}
+
+/*!
+ * \brief VSPSocket::Waiter::acknowledged Returns the number of bytes of a
+ * priority class acknowledged by the device during this connection
+ */
+qint64 QVSPSocket::Waiter::acknowledged(Priority priority) const
+{
+    return socket.writeQueues[int(priority)].acked;
+}
+
+/*!
+ * \brief VSPSocket::Waiter::lost Tells whether bytes of a stream range have
+ * been lost by the last failed write of a priority class
+ *
+ * Waiters are woken on every failure, so checking the last one suffices.
+ */
+bool QVSPSocket::Waiter::lost(Priority priority, qint64 begin, qint64 end) const
+{
+    const WriteQueue &q = socket.writeQueues[int(priority)];
+    return q.lostBegin < end && q.lostEnd > begin;
+}
+
+/*!
+ * \brief VSPSocket::wakeWaiters Wakes the registered waiters
+ * \param reason kind of progress
+ *
+ * Waiters registering meanwhile are woken by the next progress only. The
+ * list stays linked while waiters are resumed, the cursor is moved by
+ * Waiter::unlink() if the next waiter goes away.
+ */
+void QVSPSocket::wakeWaiters(Waiter::Reason reason)
+{
+    WakeCursor cursor = { waiters, wakeCursors };
+    wakeCursors = &cursor;
+    while (cursor.next != nullptr)
+    {
+        Waiter *w = cursor.next;
+        cursor.next = w->next;
+        if (w->ready(reason))
+        {
+            w->unlink();
+            w->resume(); // may destroy w and other waiters
+        }
+    }
+    wakeCursors = cursor.outer;
+}
+
+/*!
+ * \brief VSPSocket::indexOf Searches the data available for reading
+ * \return offset of \a delimiter, -1 if not found
+ */
+qint64 QVSPSocket::indexOf(char delimiter)
+{
+    // the QIODevice buffer is peeked without calling readData()
+    const qint64 buffered = QIODevice::bytesAvailable();
+    if (buffered > 0)
+    {
+        const int i = peek(buffered).indexOf(delimiter);
+        if (i >= 0)
+            return i;
+    }
+
+    const int i = readBuffer.indexOf(delimiter);
+    return i < 0 ? -1 : buffered + i;
+}
+
+/*!
+ * \brief VSPSocket::setTraceSink Sets a sink receiving timeline events of the
+ * socket
+ * \param sink trace sink, not owned, nullptr to stop
+ *
+ * The sink receives the handshake phases, every characteristic and descriptor
+ * write and its acknowledgement, every notification, the RTS and CTS levels
+ * as counters, the state changes and the event processing within readData()
+ * and writeData(). Without a sink the events cost a pointer comparison.
+ * The sink has to outlive the socket or be unset before it is destroyed. The
+ * events name the socket as their source, so a sink shared by several sockets
+ * can keep them apart.
+ *
+ * \sa QVSPChromeTraceSink
+ */
+void QVSPSocket::setTraceSink(QVSPTraceSink *sink)
+{
+    _traceSink = sink;
+    handshakeStep = nullptr; // timestamps of another sink clock
+}
+
+QVSPTraceSink *QVSPSocket::traceSink() const
+{
+    return _traceSink;
+}
+
+void QVSPSocket::trace(QVSPTraceRecorder::Event event, quint8 arg, const QByteArray &data)
+{
+    if (!tracer.isNull())
+        tracer->record(event, arg, data.constData(), data.size());
+    if (_traceSink != nullptr)
+        sinkEvent(event, arg, data.size());
+}
+
+/*!
+ * \brief VSPSocket::sinkEvent Passes a link event to the trace sink
+ * \param event event type
+ * \param arg event argument, see QVSPTraceRecorder::Event
+ * \param size size of the value written or notified
+ */
+void QVSPSocket::sinkEvent(QVSPTraceRecorder::Event event, quint8 arg, int size)
+{
+    static const char *const WRITE_EVENT[] = { "write RX FIFO", "write TX FIFO", "write modem in", "write modem out", "write BRSP mode" };
+    static const char *const NOTIFY_EVENT[] = { "notify RX FIFO", "notify TX FIFO", "notify modem in", "notify modem out", "notify BRSP mode" };
+    static const char *const DESCRIPTOR_EVENT[] = { "enable RX FIFO notify", "enable TX FIFO notify", "enable modem in notify", "enable modem out notify", "enable BRSP mode notify" };
+    static const char *const WRITTEN_EVENT[] = { "written RX FIFO", "written TX FIFO", "written modem in", "written modem out", "written BRSP mode" };
+
+    const qint64 now = _traceSink->timestamp();
+    const int id = qMin(int(arg), 4);
+    switch (event)
+    {
+    case QVSPTraceRecorder::Event::CharacteristicWrite:
+        _traceSink->event(QVSPTraceSink::Phase::Instant, "vsp", WRITE_EVENT[id], now, 0, "size", size, this);
+        break;
+    case QVSPTraceRecorder::Event::Notification:
+        _traceSink->event(QVSPTraceSink::Phase::Instant, "vsp", NOTIFY_EVENT[id], now, 0, "size", size, this);
+        break;
+    case QVSPTraceRecorder::Event::DescriptorWrite:
+        _traceSink->event(QVSPTraceSink::Phase::Instant, "vsp", DESCRIPTOR_EVENT[id], now, 0, nullptr, 0, this);
+        break;
+    case QVSPTraceRecorder::Event::CharacteristicWritten:
+        _traceSink->event(QVSPTraceSink::Phase::Instant, "vsp", WRITTEN_EVENT[id], now, 0, "size", size, this);
+        break;
+    case QVSPTraceRecorder::Event::Cts:
+        _traceSink->event(QVSPTraceSink::Phase::Counter, "vsp", "CTS", now, 0, "CTS", arg, this);
+        break;
+    case QVSPTraceRecorder::Event::Rts:
+        _traceSink->event(QVSPTraceSink::Phase::Counter, "vsp", "RTS", now, 0, "RTS", arg, this);
+        break;
+    case QVSPTraceRecorder::Event::StateChange:
+        _traceSink->event(QVSPTraceSink::Phase::Instant, "vsp", "state", now, 0, "state", arg, this);
+        break;
+    }
+}
+
+/*!
+ * \brief VSPSocket::handshakePhase Ends the current handshake phase on the
+ * trace sink and starts the next one
+ * \param name next phase, a string literal, nullptr if the handshake ended
+ */
+void QVSPSocket::handshakePhase(const char *name)
+{
+    if (_traceSink == nullptr)
+        return;
+
+    const qint64 now = _traceSink->timestamp();
+    if (handshakeStep != nullptr)
+        _traceSink->event(QVSPTraceSink::Phase::Complete, "vsp,handshake", handshakeStep, handshakeStartedAt, now - handshakeStartedAt,
+                          nullptr, 0, this);
+    handshakeStep = name;
+    handshakeStartedAt = now;
+}
+
+/*!
+ * \brief VSPSocket::processEvents Processes pending events, timed on the
+ * trace sink
+ * \param name event name, a string literal
+ */
+void QVSPSocket::processEvents(const char *name)
+{
+    QVSPTraceSink *sink = _traceSink;
+    if (sink == nullptr)
+    {
+        QAbstractEventDispatcher::instance()->processEvents(QEventLoop::ProcessEventsFlag::AllEvents);
+        return;
     }
 
-    // check for eventual incoming data
+    const qint64 start = sink->timestamp();
     QAbstractEventDispatcher::instance()->processEvents(QEventLoop::ProcessEventsFlag::AllEvents);
+    if (sink == _traceSink) // might have been replaced meanwhile
+        sink->event(QVSPTraceSink::Phase::Complete, "vsp", name, start, sink->timestamp() - start, nullptr, 0, this);
+}
 
-    QBuffer buff(&readBuffer);
-    buff.open(QIODevice::ReadOnly);
-    auto res = buff.read(data, maxlen);
-    buff.close();
-    readBuffer.remove(0, int(res));
+QVSPTraceRecorder::Characteristic QVSPSocket::traceId(const QLowEnergyCharacteristic &characteristic) const
+{
+    if (characteristic == txFifoChar)
+        return QVSPTraceRecorder::Characteristic::TxFifo;
+    if (characteristic == modemOutChar)
+        return QVSPTraceRecorder::Characteristic::ModemOut;
+    if (characteristic == rxFifoChar)
+        return QVSPTraceRecorder::Characteristic::RxFifo;
+    if (characteristic == modemInChar)
+        return QVSPTraceRecorder::Characteristic::ModemIn;
+    return QVSPTraceRecorder::Characteristic::BrspMode;
+}
 
-    if (!rts && qint64(readBuffer.size()) + PACKET_SIZE + 1 <= maxBufferSize)
-        // buffer flushed, send may continue
-        service->writeCharacteristic(modemInChar, MODEM_SET_BIT[m]); // RTS set
+/*!
+ * \brief VSPSocket::writeCharacteristic Writes a characteristic of the VSP
+ * service, or passes the write to the replay driver while replaying
+ */
+void QVSPSocket::writeCharacteristic(QVSPTraceRecorder::Characteristic id, const QByteArray &value)
+{
+    trace(QVSPTraceRecorder::Event::CharacteristicWrite, quint8(id), value);
+    writesInFlight.enqueue(id);
+
+    if (replay != nullptr)
+    {
+        replay->characteristicWrite(id, value);
+        return;
+    }
+
+    switch (id)
+    {
+    case QVSPTraceRecorder::Characteristic::RxFifo:
+        service->writeCharacteristic(rxFifoChar, value);
+        break;
+    case QVSPTraceRecorder::Characteristic::ModemIn:
+        service->writeCharacteristic(modemInChar, value);
+        break;
+    case QVSPTraceRecorder::Characteristic::BrspMode:
+        service->writeCharacteristic(brspModeChar, value);
+        break;
+    default:
+        break;
+    }
+}
+
+/*!
+ * \brief VSPSocket::writeDescriptor Writes the notification descriptor of a
+ * characteristic
+ */
+void QVSPSocket::writeDescriptor(QVSPTraceRecorder::Characteristic id, const QByteArray &value)
+{
+    trace(QVSPTraceRecorder::Event::DescriptorWrite, quint8(id), value);
+
+    if (replay != nullptr)
+        return; // replays start connected
+    service->writeDescriptor(id == QVSPTraceRecorder::Characteristic::TxFifo ? txFifoNotify : modemOutNotify, value);
+}
+
+/*!
+ * \brief VSPSocket::characteristicChanged Handles a notification
+ * \param id notified characteristic
+ * \param value new value
+ */
+void QVSPSocket::characteristicChanged(QVSPTraceRecorder::Characteristic id, const QByteArray &value)
+{
+    trace(QVSPTraceRecorder::Event::Notification, quint8(id), value);
+
+    if (id == QVSPTraceRecorder::Characteristic::TxFifo)
+    {
+        notifiedAt = clock.nsecsElapsed();
+        ++stats.packetsReceived;
+        stats.bytesReceived += quint64(value.size());
+
+        if (!capture.isNull() && !capture->append(value.constData(), value.size()))
+        {
+            setError(QLowEnergyService::ServiceError::OperationError, tr("Capture failed: %1").arg(capture->errorString()));
+            stopCapture();
+        }
+
+        if (_captureOnly && !capture.isNull())
+            ; // captured, nobody reads
+        else if (_compression != Compression::None)
+            decompressReceived(value);
+        else
+            dataReceived(value);
+    }
+    else if (id == QVSPTraceRecorder::Characteristic::ModemOut)
+    {
+        updateCTS(value == MODEM_SET_BIT[m]);
+        writeInternal(); // CTS set, now write
+    }
+}
+
+/*!
+ * \brief VSPSocket::writeFailed Settles the oldest packet awaiting
+ * acknowledgement after its write failed
+ *
+ * The acknowledged offset moves past the lost bytes, so that the following
+ * acknowledgements are credited to their own packets. The lost range is
+ * recorded for the waiters, which are woken by the error, and the futures
+ * covering it fail.
+ */
+void QVSPSocket::writeFailed()
+{
+    ++packetsAcked;
+    while (!ackPending.isEmpty() && ackPending.head().packet <= packetsAcked)
+        ackPending.dequeue(); // never acknowledged, no latency sample
+    if (inFlight.isEmpty())
+        return;
+
+    const QPair<int, int> packet = inFlight.dequeue();
+    WriteQueue &q = writeQueues[packet.first];
+    q.lostBegin = q.acked;
+    q.acked += packet.second;
+    q.lostEnd = q.acked;
+    failFutures(q, q.lostBegin, q.lostEnd);
+}
+
+/*!
+ * \brief VSPSocket::discardWrites Drops the data of a priority class not yet
+ * passed to the link
+ *
+ * The stream offsets of the dropped data are not reused: the sent offset
+ * moves past it and the acknowledged offset follows once the packets in
+ * flight are acknowledged. Futures covering it fail and the range is recorded
+ * as lost for the waiters, which the caller has to wake.
+ */
+void QVSPSocket::discardWrites(int priority)
+{
+    WriteQueue &q = writeQueues[priority];
+    q.buffer.clear();
+    q.writes.clear();
+    const qint64 discarded = q.queued - q.sent;
+    if (discarded == 0)
+        return;
+
+    failFutures(q, q.sent, q.queued);
+    q.lostBegin = q.sent;
+    q.lostEnd = q.queued;
+    q.sent = q.queued;
+
+    for (int i = inFlight.size() - 1; i >= 0; --i)
+    {
+        if (inFlight.at(i).first == priority)
+        {
+            inFlight[i].second += int(discarded); // credited with the last packet sent
+            return;
+        }
+    }
+    q.acked += discarded;
+}
+
+/*!
+ * \brief VSPSocket::discardReceived Drops the received data not read yet
+ *
+ * A partially received compressed block is dropped as well. RTS is set again
+ * if it was cleared because the buffers ran full; RTS cleared by the
+ * application or a bridge stays cleared.
+ */
+void QVSPSocket::discardReceived()
+{
+    const bool resume = rtsDesired || poolStarved || readBufferFull();
+    QIODevice::read(QIODevice::bytesAvailable()); // QIODevice buffer
+    readBuffer.clear();
+    readConsumed = readAppended;
+    arrivals.clear();
+    decompressInput.clear();
+    poolFit(0); // return the blocks of the discarded data
+    if (resume)
+        setRTS();
+}
+
+/*!
+ * \brief VSPSocket::discardPending Drops the written data not yet passed to
+ * the link
+ *
+ * Packets already passed to the link cannot be recalled. A running file
+ * transfer is aborted, the futures and awaited writes covering the dropped
+ * data fail.
+ */
+void QVSPSocket::discardPending()
+{
+    if (transfer.source != nullptr)
+        abortFileTransfer();
+    for (int p = 0; p < PRIORITY_COUNT; ++p)
+        discardWrites(p);
+    compressInput.clear();
+    flushTimer.stop();
+    compressTimer.stop();
+    poolFit(0); // return the blocks of the discarded data
+    wakeWaiters(Waiter::Reason::Error);
+}
+
+/*!
+ * \brief VSPSocket::isRequestToSend Returns the RTS level requested from the
+ * device, which may not be confirmed yet
+ */
+bool QVSPSocket::isRequestToSend() const
+{
+    return rtsDesired;
+}
+
+/*!
+ * \brief VSPSocket::isRequestToSendConfirmed Returns the RTS level last
+ * confirmed by the device
+ */
+bool QVSPSocket::isRequestToSendConfirmed() const
+{
+    return rts;
+}
+
+/*!
+ * \brief VSPSocket::characteristicWritten Handles the acknowledgement of a
+ * characteristic write
+ * \param id written characteristic
+ * \param value written value
+ */
+void QVSPSocket::characteristicWritten(QVSPTraceRecorder::Characteristic id, const QByteArray &value)
+{
+    trace(QVSPTraceRecorder::Event::CharacteristicWritten, quint8(id), value);
+    writesInFlight.removeOne(id);
+
+    if (id == QVSPTraceRecorder::Characteristic::RxFifo)
+    {
+        // acknowledgements arrive in the order of the writes
+        const qint64 now = clock.nsecsElapsed();
+        ++packetsAcked;
+        while (!ackPending.isEmpty() && ackPending.head().packet <= packetsAcked)
+            histograms[int(Latency::WriteAcknowledge)].record(now - ackPending.dequeue().queuedAt);
+        if (!inFlight.isEmpty())
+        {
+            const QPair<int, int> packet = inFlight.dequeue();
+            WriteQueue &q = writeQueues[packet.first];
+            q.acked += packet.second;
+            while (!q.futures.isEmpty() && q.futures.head().end <= q.acked)
+            {
+                PendingFuture f = q.futures.dequeue();
+                f.promise.reportFinished(&f.size);
+            }
+        }
+
+        writeInternal();
+        wakeWaiters(Waiter::Reason::Acknowledged);
+    }
+    else if (id == QVSPTraceRecorder::Characteristic::ModemIn)
+    {
+        rtsInFlight = false;
+        const bool changed = rts != (value == MODEM_SET_BIT[m]);
+        rts = value == MODEM_SET_BIT[m];
+        trace(QVSPTraceRecorder::Event::Rts, rts);
+        if (changed)
+            emit requestToSendChanged(rts);
+        if (rts && !isOpen() && service != nullptr)
+        {
+            // first RTS written, now read CTS (we could have missed its notification)
+            handshakePhase("read CTS");
+            service->readCharacteristic(modemOutChar);
+        }
+        updateRTS(rtsDesired); // issue a transition requested meanwhile
+    }
+    else if (id == QVSPTraceRecorder::Characteristic::BrspMode)
+        // BlueRadios changed into data mode, now proceed as usual
+        writeDescriptor(QVSPTraceRecorder::Characteristic::TxFifo, DESC_NOTIFY_ON); // enable notify on TX buffer
+}
+
+/*!
+ * \brief VSPSocket::startReplay Opens the socket on a simulated link driven
+ * by a trace replay
+ * \param driver replay driver receiving the characteristic writes
+ * \param manufacturer manufacturer of the recorded device
+ * \param clearToSend initial CTS state
+ */
+bool QVSPSocket::startReplay(QVSPTraceReplay *driver, Manufacturer manufacturer, bool clearToSend)
+{
+    if (isOpen() || !controller.isNull())
+        return false;
+
+    replay = driver;
+    m = manufacturer;
+    cts = clearToSend;
+    rts = true;
+    rtsDesired = true;
+
+    QIODevice::open(OpenModeFlag::ReadWrite | OpenModeFlag::Unbuffered);
+    emit stateChanged(_state = QBluetoothSocket::SocketState::ConnectedState);
+    emit connected();
+    return true;
+}
+
+bool QVSPSocket::canReadLine() const
+{
+    return QIODevice::canReadLine() || readBuffer.contains('\n');
+}
+
+/*!
+ * \brief VSPSocket::state Returns the current state of the socket
+ * \return current state
+ */
+QBluetoothSocket::SocketState QVSPSocket::state() const
+{
+    return _state;
+}
+
+/*!
+ * \brief VSPSocket::error Returns the last error
+ * \return last error
+ */
+QLowEnergyService::ServiceError QVSPSocket::error() const
+{
+    return _error;
+}
+
+/*!
+ * \brief VSPSocket::readData Reads from the read buffer
+ *
+ * The socket is opened unbuffered, so the data is copied once, from the read
+ * buffer into \a data. Only data peeked or pushed back with ungetChar() is
+ * held in the QIODevice buffer, peek() reads it through here within a
+ * transaction.
+ */
+qint64 QVSPSocket::readData(char *data, qint64 maxlen)
+{
+    if (!isOpen())
+    {
+        this->setErrorString(tr("Cannot read while not connected"));
+        emit error(_error = QLowEnergyService::ServiceError::OperationError);
+        return -1;
+    }
 
+    if (qint64(readBuffer.size()) < maxlen)
+        // check for eventual incoming data
+        processEvents("processEvents (read)");
+
+    const int res = int(qMin(maxlen, qint64(readBuffer.size())));
+    memcpy(data, readBuffer.constData(), size_t(res));
+    advanceRead(res);
     return res;
 }
 
-qint64 QVSPSocket::writeData(const char *data, qint64 len)
+/*!
+ * \brief VSPSocket::advanceRead Drops consumed bytes from the read buffer
+ * \param n number of bytes, at most the read buffer size
+ *
+ * Records the read latency of the fully consumed notifications and lets the
+ * peer send again once there is room for another packet.
+ */
+void QVSPSocket::advanceRead(int n)
+{
+    readBuffer.remove(0, n);
+    if (_bufferPool != nullptr && readBuffer.isEmpty())
+        readBuffer.clear(); // return the memory as well, not only the blocks
+
+    readConsumed += n;
+    if (!arrivals.isEmpty() && arrivals.head().end <= readConsumed)
+    {
+        const qint64 now = clock.nsecsElapsed();
+        do
+            histograms[int(Latency::NotificationRead)].record(now - arrivals.dequeue().notifiedAt);
+        while (!arrivals.isEmpty() && arrivals.head().end <= readConsumed);
+    }
+
+    if (readBufferFull())
+        poolFit(0);
+    else if (poolFit(rtsDesired ? 0 : PACKET_SIZE + 1))
+    {
+        // buffer flushed, send may continue
+        poolStarved = false;
+        updateRTS(true); // RTS set
+    }
+    else
+    {
+        poolStarved = true; // resumed on the release of the buffer pool
+        updateRTS(false); // RTS clear
+        poolFit(0);
+    }
+}
+
+/*!
+ * \brief VSPSocket::bufferedBytes Returns the data held in the socket buffers
+ */
+qint64 QVSPSocket::bufferedBytes() const
+{
+    qint64 bytes = readBuffer.size() + decompressInput.size() + compressInput.size();
+    for (const WriteQueue &q: writeQueues)
+        bytes += q.buffer.size();
+    return bytes;
+}
+
+/*!
+ * \brief VSPSocket::poolFit Adjusts the blocks borrowed from the buffer pool
+ * \param extra bytes about to be buffered
+ * \return false if the pool cannot lend the missing blocks, the borrowed
+ * blocks are unchanged then
+ *
+ * The blocks cover the buffered data plus \a extra and, while RTS is set,
+ * room for one more packet. Surplus blocks are returned. Without a pool it
+ * always succeeds.
+ */
+bool QVSPSocket::poolFit(qint64 extra)
+{
+    if (_bufferPool == nullptr)
+        return true;
+
+    const qint64 bytes = bufferedBytes() + (rtsDesired ? PACKET_SIZE + 1 : 0) + extra;
+    const int blocks = int((bytes + _bufferPool->blockSize() - 1) / _bufferPool->blockSize());
+    if (blocks > poolBlocks)
+    {
+        if (!_bufferPool->acquire(blocks - poolBlocks))
+            return false;
+    }
+    else
+        _bufferPool->release(poolBlocks - blocks);
+    poolBlocks = blocks;
+    return true;
+}
+
+/*!
+ * \brief VSPSocket::poolRoom Returns how many more bytes the buffer pool can
+ * currently take from this socket
+ */
+qint64 QVSPSocket::poolRoom() const
+{
+    if (_bufferPool == nullptr)
+        return INT_MAX;
+
+    return (qint64(poolBlocks) + _bufferPool->blocksAvailable()) * _bufferPool->blockSize()
+            - bufferedBytes() - (rtsDesired ? PACKET_SIZE + 1 : 0);
+}
+
+/*!
+ * \brief VSPSocket::readView Returns the received data without copying it
+ * \return view on the read buffer
+ *
+ * The view refers to the socket's memory and stays valid until the next
+ * read, peek(), consume(), write() or anything else processing events, or the
+ * return to the event loop; copy what has to outlive that. Bytes held in the
+ * QIODevice buffer by peek() or ungetChar() precede the view and are not part
+ * of it, read() them first.
+ *
+ * Lets decoders inspect a header in place and then consume() exactly the
+ * bytes they parsed.
+ */
+QByteArray QVSPSocket::readView() const
+{
+    return QByteArray::fromRawData(readBuffer.constData(), readBuffer.size());
+}
+
+/*!
+ * \brief VSPSocket::consume Discards data at the front of the read view
+ * \param n number of bytes
+ * \return number of bytes discarded, -1 on error
+ *
+ * Has the effect of a read() of \a n bytes, including flow control, without
+ * copying them.
+ */
+qint64 QVSPSocket::consume(qint64 n)
 {
     if (!isOpen())
     {
-        this->setErrorString(tr("Cannot write while not connected"));
+        this->setErrorString(tr("Cannot read while not connected"));
         emit error(_error = QLowEnergyService::ServiceError::OperationError);
         return -1;
     }
 
-    // check for eventual CTS variation
-    QAbstractEventDispatcher::instance()->processEvents(QEventLoop::ProcessEventsFlag::AllEvents);
+    const int res = int(qBound(qint64(0), n, qint64(readBuffer.size())));
+    advanceRead(res);
+    return res;
+}
 
-    if (qint64(writeBuffer.size()) + len + 1 > maxBufferSize) {
-        this->setErrorString(tr("Internal write buffer overflow (max. size %1), write failed").arg(maxBufferSize));
+/*!
+ * \brief VSPSocket::readLineData Reads up to and including the next newline
+ *
+ * Served from the read buffer in one go, instead of the byte by byte default
+ * of unbuffered devices. Without a buffered newline, events are processed
+ * once and the buffer is searched again, so that data notified meanwhile
+ * ends the line at its newline as well.
+ */
+qint64 QVSPSocket::readLineData(char *data, qint64 maxlen)
+{
+    if (!isOpen())
+    {
+        this->setErrorString(tr("Cannot read while not connected"));
         emit error(_error = QLowEnergyService::ServiceError::OperationError);
         return -1;
     }
 
-    writeBuffer.append(data, int(len));
-    writeInternal(); // try to write immediately, otherwise after CTS is set
-    return len;
+    int newline = readBuffer.indexOf('\n');
+    if (newline < 0 && qint64(readBuffer.size()) < maxlen)
+    {
+        // check for eventual incoming data
+        processEvents("processEvents (read)");
+        newline = readBuffer.indexOf('\n');
+    }
+
+    const qint64 len = newline < 0 ? maxlen : qMin(maxlen, qint64(newline) + 1);
+    const int res = int(qMin(len, qint64(readBuffer.size())));
+    memcpy(data, readBuffer.constData(), size_t(res));
+    advanceRead(res);
+    return res;
+}
+
+qint64 QVSPSocket::writeData(const char *data, qint64 len)
+{
+    const QByteArray segment = QByteArray::fromRawData(data, int(len));
+    return queueWrite(&segment, 1, Priority::Normal, false);
 }
 
 /*!
@@ -493,8 +2414,9 @@ qint64 QVSPSocket::writeData(const char *data, qint64 len)
  */
 void QVSPSocket::unsetRTS()
 {
-    if (rts)
-        service->writeCharacteristic(modemInChar, MODEM_CLEAR_BIT[m]); // RTS clear
+    poolStarved = false; // not to be set again on the release of the buffer pool
+    updateRTS(false); // RTS clear
+    poolFit(0); // no headroom while RTS is cleared
 }
 
 /*!
@@ -507,9 +2429,94 @@ void QVSPSocket::unsetRTS()
  */
 void QVSPSocket::setRTS()
 {
-    if (!rts && qint64(readBuffer.size()) + PACKET_SIZE + 1 <= maxBufferSize)
+    if (!readBufferFull() && poolFit(rtsDesired ? 0 : PACKET_SIZE + 1))
+    {
         // buffer flushed, send may continue
-        service->writeCharacteristic(modemInChar, MODEM_SET_BIT[m]); // RTS set
+        poolStarved = false;
+        updateRTS(true); // RTS set
+    }
+}
+
+int QVSPSocket::readBufferLimit() const
+{
+    return maxBufferSize;
+}
+
+/*!
+ * \brief VSPSocket::setReadBufferLimit Sets the capacity of the read buffer
+ * \param limit bytes, 21 .. INT_MAX
+ *
+ * RTS is cleared when the buffer cannot take another packet. With a buffer
+ * pool the limit caps the share a single socket may take from it.
+ */
+void QVSPSocket::setReadBufferLimit(int limit)
+{
+    maxBufferSize = qMax(PACKET_SIZE + 1, limit);
+}
+
+int QVSPSocket::writeBufferLimit() const
+{
+    return maxWriteBufferSize;
+}
+
+/*!
+ * \brief VSPSocket::setWriteBufferLimit Sets the capacity of the write buffer
+ * of each priority class
+ * \param limit bytes, 21 .. INT_MAX
+ *
+ * Writes not fitting the buffer fail.
+ */
+void QVSPSocket::setWriteBufferLimit(int limit)
+{
+    maxWriteBufferSize = qMax(PACKET_SIZE + 1, limit);
+}
+
+/*!
+ * \brief VSPSocket::setBufferPool Makes the socket borrow its buffer memory
+ * from a pool shared with other sockets
+ * \param pool buffer pool, not owned, nullptr to stop
+ *
+ * Blocks are borrowed as data is received or queued for writing and returned
+ * as it is read or sent; a drained read buffer also frees its memory. When
+ * the pool cannot hold another received packet RTS is cleared until blocks
+ * are released, writes beyond it fail and a file transfer waits. The read and
+ * write buffer limits still apply per socket. The pool has to outlive the
+ * socket or be unset before it is destroyed.
+ *
+ * The buffers stay contiguous for readView() and line scans, the blocks are
+ * the unit in which the shared budget is lent. Packets the device sends
+ * while the clearing of RTS is in flight are taken even over the budget.
+ */
+void QVSPSocket::setBufferPool(QVSPBufferPool *pool)
+{
+    if (pool == _bufferPool)
+        return;
+
+    if (_bufferPool != nullptr)
+    {
+        disconnect(_bufferPool, nullptr, this, nullptr);
+        _bufferPool->release(poolBlocks);
+        poolBlocks = 0;
+    }
+    _bufferPool = pool;
+    poolStarved = false;
+    if (_bufferPool == nullptr)
+        return;
+
+    connect(_bufferPool, &QVSPBufferPool::released, this, [this]() {
+        if (poolStarved && !readBufferFull() && poolFit(PACKET_SIZE + 1))
+        {
+            poolStarved = false;
+            updateRTS(true); // RTS set
+        }
+        pumpFile();
+    }, Qt::QueuedConnection);
+    poolFit(0); // data already buffered
+}
+
+QVSPBufferPool *QVSPSocket::bufferPool() const
+{
+    return _bufferPool;
 }
 
 } // namespace
@@ -36,14 +36,23 @@
 #define QVSPSOCKET_H
 
 #include "qvspsocket_global.h"
+#include "qvspcapture.h"
+#include "qvsptrace.h"
+#include "qvsphistogram.h"
+#include "qvsptracesink.h"
+#include "qvspbufferpool.h"
 
 namespace MiVSP
 {
 
+class QVSPTraceReplay;
+
 class QVSPSOCKETSHARED_EXPORT QVSPSocket : public QIODevice
 {
     Q_OBJECT
 
+    friend class QVSPTraceReplay;
+
 public:
     enum class Manufacturer
     {
@@ -52,7 +61,173 @@ public:
     };
     Q_ENUM(Manufacturer)
 
+    enum class Priority
+    {
+        Normal,
+        High
+    };
+    Q_ENUM(Priority)
+
+    enum class Compression
+    {
+        None,
+        Heatshrink
+    };
+    Q_ENUM(Compression)
+
+    enum class CompressionFlush
+    {
+        EveryWrite, // every write is compressed and sent right away
+        FullBlock   // normal priority data is compressed in full blocks
+    };
+    Q_ENUM(CompressionFlush)
+
+    struct CompressionCounters
+    {
+        quint64 bytesIn = 0; // uncompressed bytes written
+        quint64 bytesOut = 0; // compressed bytes queued, block headers included
+        qint64 compressTime = 0; // ns
+        quint64 bytesReceived = 0; // compressed bytes received
+        quint64 bytesExpanded = 0;
+        qint64 decompressTime = 0; // ns
+        quint64 storedBlocks = 0; // blocks sent uncompressed as they did not shrink
+    };
+
+    struct Statistics
+    {
+        quint64 bytesSent = 0;
+        quint64 packetsSent = 0;
+        quint64 bytesReceived = 0;
+        quint64 packetsReceived = 0;
+        quint64 readyReadEmitted = 0;
+        quint64 rtsSetWrites = 0;
+        quint64 rtsClearWrites = 0;
+        quint64 ctsStalls = 0; // CTS cleared by the device
+        qint64 ctsStallTime = 0; // ns with CTS cleared, ongoing stall included
+        quint64 readOverflows = 0; // packets dropped
+        quint64 writeOverflows = 0; // writes failed
+        qint64 peakReadBuffer = 0; // bytes
+        qint64 peakWriteBuffer = 0;
+    };
+
+    enum class Latency
+    {
+        WriteAcknowledge, // write() to the acknowledgement of its last packet
+        NotificationRead, // TX FIFO notification to its last byte being read
+        CtsStall          // CTS cleared to CTS set
+    };
+    Q_ENUM(Latency)
+
+    struct WriteLatency
+    {
+        quint64 count = 0; // completed writes
+        qint64 last = 0;   // ns from queueing to the last byte leaving
+        qint64 max = 0;
+        qint64 total = 0;
+    };
+
+    // suspended operation resumed from the link handlers, see qvspawait.h
+    class QVSPSOCKETSHARED_EXPORT Waiter
+    {
+        friend class QVSPSocket;
+
+    public:
+        enum class Reason
+        {
+            Data,         // data has been received
+            Acknowledged, // the device acknowledged a packet
+            State,        // the socket state changed
+            Error
+        };
+
+    private:
+        Waiter *next = nullptr;
+        bool waiting = false;
+
+        void unlink();
+
+    protected:
+        QVSPSocket &socket;
+
+        explicit Waiter(QVSPSocket &socket);
+        virtual ~Waiter();
+
+        void wait();
+        virtual bool ready(Reason reason) = 0;
+        virtual void resume() = 0;
+
+        qint64 indexOf(char delimiter) const;
+        qint64 queued(Priority priority) const;
+        qint64 acknowledged(Priority priority) const;
+        bool lost(Priority priority, qint64 begin, qint64 end) const;
+    };
+
 private:
+    static const int PRIORITY_COUNT = 2;
+
+    struct PendingWrite
+    {
+        qint64 begin; // stream offsets within the priority class
+        qint64 end;
+        qint64 queuedAt; // ns on clock
+        bool atomic; // must not be interleaved with other classes
+    };
+    // queued data as a list of implicitly shared buffers
+    struct SegmentQueue
+    {
+        QQueue<QByteArray> segments;
+        int offset = 0; // bytes of the head segment already taken
+        int bytes = 0;
+        bool tailCopied = false; // the tail segment is a private copy and may grow
+
+        int size() const;
+        bool isEmpty() const;
+        void append(const QByteArray &segment);
+        QByteArray take(int len);
+        void clear();
+    };
+    struct PendingFuture
+    {
+        qint64 begin; // stream offsets of the data within the priority class
+        qint64 end;
+        qint64 size;
+        QFutureInterface<qint64> promise;
+    };
+    struct WriteQueue
+    {
+        SegmentQueue buffer;
+        qint64 queued = 0; // bytes ever queued
+        qint64 sent = 0; // bytes ever handed to the link
+        qint64 acked = 0; // bytes ever acknowledged by the device
+        qint64 lostBegin = 0; // last range of bytes lost by a failed write
+        qint64 lostEnd = 0;
+        QQueue<PendingWrite> writes;
+        QQueue<PendingFuture> futures; // ordered by end
+        WriteLatency latency;
+    };
+    struct AckPending
+    {
+        quint64 packet; // sequence number of the packet completing the write
+        qint64 queuedAt; // ns on clock
+    };
+    struct Arrival
+    {
+        qint64 end; // read stream offset after the notified data
+        qint64 notifiedAt; // ns on clock
+    };
+    struct FileTransfer
+    {
+        QIODevice *source = nullptr;
+        QScopedPointer<QFile> file; // opened by sendFile(path)
+        uchar *map = nullptr;
+        qint64 size = -1; // -1 if unknown
+        qint64 read = 0; // bytes taken from the source
+        qint64 end = -1; // normal priority queue offset after the last byte
+        qint64 startedAt = 0; // ns on clock
+        bool sourceFinished = false;
+        bool pumping = false;
+    };
+
     QBluetoothSocket::SocketState _state = QBluetoothSocket::SocketState::UnconnectedState;
     QLowEnergyService::ServiceError _error = QLowEnergyService::ServiceError::NoError;
 
@@ -71,18 +246,111 @@ private:
     QLowEnergyDescriptor modemOutNotify;
 
     bool cts = false; // CTS = clear to send to device (set by device)
-    bool rts = false; // RTS = request to send from device (set by us)
+    bool rts = false; // RTS = request to send from device (set by us, confirmed by device)
+    bool rtsDesired = false; // RTS state we want the device to end up in
+    bool rtsInFlight = false; // an RTS write is pending acknowledgement
+    qint64 ctsClearedAt = -1; // ns on clock when CTS was cleared, -1 if set
+
+    Statistics stats;
+    QVSPHistogram histograms[3]; // indexed by Latency
+    QQueue<AckPending> ackPending; // completed writes awaiting acknowledgement
+    QQueue<QPair<int, int>> inFlight; // priority class and size of the packets awaiting acknowledgement
+    QQueue<QVSPTraceRecorder::Characteristic> writesInFlight; // characteristic writes awaiting their response
+    quint64 packetsQueued = 0; // RX FIFO writes issued in this connection
+    quint64 packetsAcked = 0;
+    QQueue<Arrival> arrivals; // notified data not yet read
+    qint64 readAppended = 0; // bytes ever appended to the read buffer
+    qint64 readConsumed = 0;
+    qint64 notifiedAt = 0; // ns on clock of the notification being processed
 
-    int maxBufferSize = 4096; // maximum input and output buffer size 21 .. INT_MAX
+    int maxBufferSize = 4096; // maximum input buffer size 21 .. INT_MAX
+    int maxWriteBufferSize = 4096; // maximum output buffer size per priority class 21 .. INT_MAX
     QByteArray readBuffer;
-    QByteArray writeBuffer;
+    WriteQueue writeQueues[PRIORITY_COUNT];
+    QVSPBufferPool *_bufferPool = nullptr;
+    int poolBlocks = 0; // borrowed from the buffer pool
+    bool poolStarved = false; // RTS cleared because the buffer pool ran out
+    QElapsedTimer clock;
+
+    bool _noDelay = true; // send partial packets immediately
+    int _flushDeadline = 10000; // us a partial packet may be held back
+    qint64 flushOffset = 0; // normal priority data before this offset is not held back
+    QTimer flushTimer;
+
+    Compression _compression = Compression::None;
+    CompressionFlush _compressionFlush = CompressionFlush::EveryWrite;
+    int _compressionBlockSize = 512;
+    QByteArray compressInput; // normal priority data waiting for a full block
+    QByteArray decompressInput; // incomplete received block
+    QTimer compressTimer;
+    CompressionCounters compressionTotals;
+
+    FileTransfer transfer;
+
+    QScopedPointer<QVSPCaptureFile> capture;
+    bool _captureOnly = false; // received data bypasses the read buffer while capturing
+    QScopedPointer<QVSPTraceRecorder> tracer;
+    Waiter *waiters = nullptr;
+    struct WakeCursor
+    {
+        Waiter *next; // next waiter to be checked
+        WakeCursor *outer; // of an enclosing wakeWaiters()
+    };
+    WakeCursor *wakeCursors = nullptr;
+    QVSPTraceSink *_traceSink = nullptr;
+    const char *handshakeStep = nullptr; // current handshake phase on the trace sink
+    qint64 handshakeStartedAt = 0; // ns on the trace sink clock
 
     void writeInternal();
+    qint64 queueWrite(const QByteArray *segments, int count, Priority priority, bool atomic);
+    void enqueue(WriteQueue &q, const QByteArray *segments, int count, bool atomic);
+    void failFutures();
+    void failFutures(WriteQueue &q, qint64 begin, qint64 end);
+    void discardWrites(int priority);
+    void advanceRead(int n);
+    qint64 bufferedBytes() const;
+    bool poolFit(qint64 extra);
+    qint64 poolRoom() const;
+    void compressWrite(const QByteArray *segments, int count, Priority priority);
+    void compressBlocks(const char *data, int len, Priority priority);
+    void compressStaged();
+    void decompressReceived(const QByteArray &data);
+    void pumpFile();
+    void endFileTransfer();
+    void trace(QVSPTraceRecorder::Event event, quint8 arg, const QByteArray &data = QByteArray());
+    QVSPTraceRecorder::Characteristic traceId(const QLowEnergyCharacteristic &characteristic) const;
+    void sinkEvent(QVSPTraceRecorder::Event event, quint8 arg, int size);
+    void wakeWaiters(Waiter::Reason reason);
+    void writeFailed();
+    qint64 indexOf(char delimiter);
+    void handshakePhase(const char *name);
+    void processEvents(const char *name);
+
+    // link access, a seam for QVSPTraceReplay
+    QVSPTraceReplay *replay = nullptr;
+    void writeCharacteristic(QVSPTraceRecorder::Characteristic id, const QByteArray &value);
+    void writeDescriptor(QVSPTraceRecorder::Characteristic id, const QByteArray &value);
+    void characteristicChanged(QVSPTraceRecorder::Characteristic id, const QByteArray &value);
+    void characteristicWritten(QVSPTraceRecorder::Characteristic id, const QByteArray &value);
+    bool startReplay(QVSPTraceReplay *driver, Manufacturer manufacturer, bool clearToSend);
+    void updateRTS(bool set);
+    bool readBufferFull() const;
+    void updateCTS(bool set);
 
 protected:
     qint64 readData(char *data, qint64 maxlen) override;
+    qint64 readLineData(char *data, qint64 maxlen) override;
     qint64 writeData(const char *data, qint64 len) override;
 
+    virtual void dataReceived(const QByteArray &data);
+    qint64 writeSegments(const QByteArray *segments, int count, Priority priority = Priority::Normal);
+    qint64 writeSegments(std::initializer_list<QByteArray> segments, Priority priority = Priority::Normal);
+    void setError(QLowEnergyService::ServiceError error, const QString &errorString);
+    void discardReceived();
+    void discardPending();
+    bool isRequestToSend() const;
+    bool isRequestToSendConfirmed() const;
+
 public:
     explicit QVSPSocket(QObject* parent = nullptr);
     explicit QVSPSocket(int maxBufferSize, QObject* parent = nullptr);
@@ -96,9 +364,67 @@ public:
     qint64 bytesAvailable() const override;
     qint64 bytesToWrite() const override;
     bool canReadLine() const override;
+    QByteArray readView() const;
+    qint64 consume(qint64 n);
+
+    using QIODevice::write;
+    qint64 write(const QByteArray &data, Priority priority);
+    QFuture<qint64> writeAsync(const QByteArray &data, Priority priority = Priority::Normal);
+    qint64 writev(const QList<QByteArray> &segments, Priority priority = Priority::Normal);
+    qint64 writev(std::initializer_list<QByteArray> segments, Priority priority = Priority::Normal);
+    qint64 bytesToWrite(Priority priority) const;
+    qint64 writeRoom(Priority priority = Priority::Normal) const;
+    WriteLatency writeLatency(Priority priority) const;
+
+    Statistics statistics() const;
+    void resetStatistics();
+    QVSPHistogram latencyHistogram(Latency latency) const;
+    void resetLatencyHistograms();
+
+    int readBufferLimit() const;
+    void setReadBufferLimit(int limit);
+    int writeBufferLimit() const;
+    void setWriteBufferLimit(int limit);
+    void setBufferPool(QVSPBufferPool *pool);
+    QVSPBufferPool *bufferPool() const;
+
+    bool flush();
+    bool noDelay() const;
+    void setNoDelay(bool noDelay);
+    int flushDeadline() const;
+    void setFlushDeadline(int usecs);
+
+    Compression compression() const;
+    void setCompression(Compression compression);
+    CompressionFlush compressionFlush() const;
+    void setCompressionFlush(CompressionFlush compressionFlush);
+    int compressionBlockSize() const;
+    void setCompressionBlockSize(int compressionBlockSize);
+    CompressionCounters compressionCounters() const;
+    void resetCompressionCounters();
+
+    bool sendFile(QIODevice *source);
+    bool sendFile(const QString &path);
+    bool isSendingFile() const;
+    void abortFileTransfer();
+
+    bool startCapture(const QString &path, bool timestamps = false);
+    void stopCapture();
+    bool isCapturing() const;
+    qint64 capturedBytes() const;
+    bool captureOnly() const;
+    void setCaptureOnly(bool captureOnly);
+
+    bool startTrace(const QString &path, int bufferSize = 1 << 20);
+    void stopTrace();
+    bool isTracing() const;
+    quint32 droppedTraceEvents() const;
+    void setTraceSink(QVSPTraceSink *sink);
+    QVSPTraceSink *traceSink() const;
 
     void unsetRTS();
     void setRTS();
+    bool isClearToSend() const;
 
     QBluetoothSocket::SocketState state() const;
     QLowEnergyService::ServiceError error() const;
@@ -108,6 +434,10 @@ signals:
     void disconnected();
     void stateChanged(QBluetoothSocket::SocketState state);
     void error(QLowEnergyService::ServiceError error);
+    void fileProgress(qint64 bytesSent, qint64 bytesTotal, qint64 bytesPerSecond);
+    void fileSent();
+    void clearToSendChanged(bool set);
+    void requestToSendChanged(bool set); // confirmed by the device
 };
 
 /*!
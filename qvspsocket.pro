@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += bluetooth
+QT       += bluetooth network
 QT       -= gui
 
 TARGET = qvspsocket
@@ -13,12 +13,43 @@ TEMPLATE = lib
 DEFINES += QVSPSOCKET_LIBRARY
 DEFINES += QT_NO_CAST_FROM_ASCII QT_NO_CAST_TO_ASCII
 
-SOURCES += qvspsocket.cpp
+SOURCES += qvspsocket.cpp\
+        qvspmessagesocket.cpp\
+        qvspcodec.cpp\
+        qvspchecksum.cpp\
+        qvspreliablesocket.cpp\
+        qvspmultiplexsocket.cpp\
+        qvspcapture.cpp\
+        qvsptrace.cpp\
+        qvspreplay.cpp\
+        qvsphistogram.cpp\
+        qvsptracesink.cpp\
+        qvspserialport.cpp\
+        qvsptcpbridge.cpp\
+        qvspbufferpool.cpp
 
 HEADERS += qvspsocket.h\
-        qvspsocket_global.h
+        qvspsocket_global.h\
+        qvspmessagesocket.h\
+        qvspcodec.h\
+        qvspchecksum.h\
+        qvspreliablesocket.h\
+        qvspmultiplexsocket.h\
+        qvspcapture.h\
+        qvsptrace.h\
+        qvspreplay.h\
+        qvsphistogram.h\
+        qvsptracesink.h\
+        qvspserialport.h\
+        qvsptcpbridge.h\
+        qvspawait.h\
+        qvspbufferpool.h
 
 unix {
+    # pseudo-terminal bridge
+    SOURCES += qvspptybridge.cpp
+    HEADERS += qvspptybridge.h
+
     # custom library paths
     isEmpty(PREFIX) {
         contains(MEEGO_EDITION,harmattan) {
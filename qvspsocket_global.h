@@ -47,5 +47,14 @@
 #include <QLowEnergyController>
 #include <QBluetoothSocket>
 #include <QSharedPointer>
+#include <QQueue>
+#include <QPair>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFile>
+#include <QScopedPointer>
+#include <initializer_list>
 
 #endif // QVSPSOCKET_GLOBAL_H
@@ -0,0 +1,329 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvsptcpbridge.h"
+
+namespace MiVSP
+{
+
+/*!
+ * \brief QVSPTcpBridge::QVSPTcpBridge Creates a server exposing VSP sockets as
+ * TCP endpoints on localhost
+ * \param parent parent
+ *
+ * Every socket gets its own listening port. Data received from the device is
+ * sent to all clients of the port, data sent by any client is written to the
+ * device, interleaved in chunks. Everything runs non-blocking in the thread
+ * of the bridge, so one gateway process can serve hundreds of devices.
+ *
+ * Flow control is end to end:
+ * - device to clients: the link is only read while every client has less
+ *   than maxClientQueue() bytes queued. Otherwise RTS is cleared and the
+ *   link is resumed once all clients have drained to half of it, so a slow
+ *   reader holds back the device instead of losing data. While no client is
+ *   connected the data is kept in the socket read buffer.
+ * - clients to device: a client is only read while the socket write buffer
+ *   has room, and the TCP receive buffer of a client is bounded, so the TCP
+ *   window throttles fast writers.
+ */
+QVSPTcpBridge::QVSPTcpBridge(QObject* parent)
+    : QObject(parent)
+{
+}
+
+QVSPTcpBridge::~QVSPTcpBridge()
+{
+    while (!endpoints.isEmpty())
+        removeSocket(endpoints.firstKey());
+}
+
+/*!
+ * \brief QVSPTcpBridge::addSocket Starts listening for clients of a socket
+ * \param socket socket, connected or not; removed automatically when destroyed
+ * \param port TCP port on 127.0.0.1, 0 to choose a free one
+ * \return the listening port, 0 on error (see errorString())
+ */
+quint16 QVSPTcpBridge::addSocket(QVSPSocket *socket, quint16 port)
+{
+    if (endpoints.contains(socket))
+        return this->port(socket);
+
+    Endpoint *endpoint = new Endpoint;
+    endpoint->socket = socket;
+    endpoint->server = new QTcpServer(this);
+    if (!endpoint->server->listen(QHostAddress::LocalHost, port))
+    {
+        _errorString = endpoint->server->errorString();
+        delete endpoint->server;
+        delete endpoint;
+        return 0;
+    }
+    endpoints.insert(socket, endpoint);
+
+    connect(endpoint->server, &QTcpServer::newConnection, this, [this, endpoint]() {
+        while (endpoint->server->hasPendingConnections())
+            addClient(endpoint, endpoint->server->nextPendingConnection());
+    });
+    connect(socket, &QIODevice::readyRead, endpoint->server, [this, endpoint]() {
+        linkToClients(endpoint);
+    });
+    connect(socket, &QIODevice::bytesWritten, endpoint->server, [this, endpoint]() {
+        clientsToLink(endpoint); // room in the write buffer again
+    });
+    connect(socket, &QVSPSocket::connected, endpoint->server, [this, endpoint]() {
+        clientsToLink(endpoint);
+    });
+    connect(socket, &QObject::destroyed, endpoint->server, [this, socket]() {
+        removeEndpoint(socket, true);
+    });
+
+    return endpoint->server->serverPort();
+}
+
+/*!
+ * \brief QVSPTcpBridge::removeSocket Stops listening and disconnects the
+ * clients of a socket
+ */
+void QVSPTcpBridge::removeSocket(QVSPSocket *socket)
+{
+    removeEndpoint(socket, false);
+}
+
+/*!
+ * \brief QVSPTcpBridge::removeEndpoint Frees the endpoint of a socket
+ * \param socket socket
+ * \param destroyed true if called from QObject::destroyed(), the socket must
+ * not be touched then
+ *
+ * A slot may remove the socket while the bridge is inside a socket call that
+ * processes events. The endpoint is detached at once then, but only freed
+ * once that transfer returns.
+ */
+void QVSPTcpBridge::removeEndpoint(QVSPSocket *socket, bool destroyed)
+{
+    Endpoint *endpoint = endpoints.take(socket);
+    if (endpoint == nullptr)
+        return;
+
+    endpoint->removed = true;
+    for (QTcpSocket *client: endpoint->clients)
+    {
+        client->disconnect(this);
+        client->abort();
+    }
+    endpoint->server->disconnect(this);
+    endpoint->server->close();
+    if (!destroyed)
+    {
+        socket->disconnect(endpoint->server);
+        if (endpoint->paused)
+            socket->setRTS(); // no longer held back by the bridge
+    }
+    endpoint->paused = false;
+    release(endpoint);
+}
+
+/*!
+ * \brief QVSPTcpBridge::release Frees a removed endpoint unless a transfer is
+ * still using it
+ */
+void QVSPTcpBridge::release(Endpoint *endpoint)
+{
+    if (!endpoint->removed || endpoint->toClients || endpoint->toLink)
+        return;
+
+    delete endpoint->server; // deletes its clients and disconnects the lambdas
+    delete endpoint;
+}
+
+quint16 QVSPTcpBridge::port(QVSPSocket *socket) const
+{
+    const Endpoint *endpoint = endpoints.value(socket);
+    return endpoint == nullptr ? 0 : endpoint->server->serverPort();
+}
+
+int QVSPTcpBridge::clientCount(QVSPSocket *socket) const
+{
+    const Endpoint *endpoint = endpoints.value(socket);
+    return endpoint == nullptr ? 0 : endpoint->clients.size();
+}
+
+void QVSPTcpBridge::addClient(Endpoint *endpoint, QTcpSocket *client)
+{
+    endpoint->clients.append(client);
+    client->setReadBufferSize(_maxClientQueue);
+
+    connect(client, &QIODevice::readyRead, this, [this, endpoint]() {
+        clientsToLink(endpoint);
+    });
+    connect(client, &QIODevice::bytesWritten, this, [this, endpoint]() {
+        resume(endpoint);
+    });
+    connect(client, &QTcpSocket::disconnected, this, [this, endpoint, client]() {
+        endpoint->clients.removeOne(client);
+        client->deleteLater();
+        resume(endpoint); // it might have been the one lagging
+    });
+
+    linkToClients(endpoint); // data received while nobody listened
+}
+
+/*!
+ * \brief QVSPTcpBridge::linkToClients Fans received data out to the clients
+ *
+ * Each chunk is read from the link once and queued to every client.
+ */
+void QVSPTcpBridge::linkToClients(Endpoint *endpoint)
+{
+    if (endpoint->paused || endpoint->toClients || endpoint->clients.isEmpty())
+        return;
+    endpoint->toClients = true;
+
+    QVSPSocket *socket = endpoint->socket;
+    while (socket->isOpen() && socket->bytesAvailable() > 0 && !endpoint->clients.isEmpty())
+    {
+        const QByteArray chunk = socket->read(CHUNK_SIZE);
+        if (endpoint->removed || chunk.isEmpty())
+            break;
+
+        bool lagging = false;
+        for (QTcpSocket *client: endpoint->clients)
+        {
+            client->write(chunk);
+            lagging = lagging || client->bytesToWrite() >= _maxClientQueue;
+        }
+
+        if (lagging)
+        {
+            // hold the device back until the slowest client catches up
+            endpoint->paused = true;
+            socket->unsetRTS();
+            break;
+        }
+    }
+
+    endpoint->toClients = false;
+    release(endpoint);
+}
+
+/*!
+ * \brief QVSPTcpBridge::resume Resumes reading the link once all clients have
+ * drained to half of the maximum queue
+ */
+void QVSPTcpBridge::resume(Endpoint *endpoint)
+{
+    if (!endpoint->paused)
+        return;
+
+    for (const QTcpSocket *client: endpoint->clients)
+    {
+        if (client->bytesToWrite() > _maxClientQueue / 2)
+            return;
+    }
+
+    endpoint->paused = false;
+    endpoint->socket->setRTS();
+    linkToClients(endpoint);
+}
+
+/*!
+ * \brief QVSPTcpBridge::clientsToLink Writes data of the clients to the device,
+ * as much as the socket write buffer takes
+ *
+ * Client data is only consumed once the socket has accepted it.
+ */
+void QVSPTcpBridge::clientsToLink(Endpoint *endpoint)
+{
+    if (endpoint->toLink)
+        return;
+    endpoint->toLink = true;
+
+    QVSPSocket *socket = endpoint->socket;
+    bool progress = true;
+    while (progress && socket->isOpen())
+    {
+        progress = false;
+        for (int i = 0; i < endpoint->clients.size(); ++i)
+        {
+            const qint64 room = socket->writeRoom();
+            if (room <= 0)
+                break; // resumed by bytesWritten() or new client data
+
+            QTcpSocket *client = endpoint->clients.at(i);
+            if (client->bytesAvailable() == 0)
+                continue;
+            const QByteArray chunk = client->peek(qMin<qint64>(room, CHUNK_SIZE));
+            const qint64 written = chunk.isEmpty() ? 0 : socket->write(chunk);
+            if (endpoint->removed || written <= 0)
+            {
+                progress = false;
+                break; // kept in the client buffer, retried on bytesWritten()
+            }
+            if (endpoint->clients.contains(client))
+                client->skip(written);
+            progress = true;
+        }
+    }
+
+    endpoint->toLink = false;
+    release(endpoint);
+}
+
+qint64 QVSPTcpBridge::maxClientQueue() const
+{
+    return _maxClientQueue;
+}
+
+/*!
+ * \brief QVSPTcpBridge::setMaxClientQueue Sets the bound of the queues of each
+ * client, in both directions
+ * \param maxClientQueue bytes, at least CHUNK_SIZE
+ */
+void QVSPTcpBridge::setMaxClientQueue(qint64 maxClientQueue)
+{
+    _maxClientQueue = qMax<qint64>(CHUNK_SIZE, maxClientQueue);
+    for (Endpoint *endpoint: endpoints)
+    {
+        for (QTcpSocket *client: endpoint->clients)
+            client->setReadBufferSize(_maxClientQueue);
+        resume(endpoint);
+    }
+}
+
+QString QVSPTcpBridge::errorString() const
+{
+    return _errorString;
+}
+
+} // namespace
@@ -0,0 +1,232 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvsptrace.h"
+#include <QThread>
+#include <QDateTime>
+#include <QtEndian>
+#include <cstring>
+
+namespace MiVSP
+{
+
+static const char TRACE_MAGIC[8] = { 'V', 'S', 'P', 'T', 'R', 'A', 'C', 'E' };
+static const int MAX_RECORD_DATA = 0xFFFF;
+static const unsigned long FLUSH_INTERVAL = 10; // ms
+
+class QVSPTraceRecorder::Writer : public QThread
+{
+    QVSPTraceRecorder *recorder;
+
+public:
+    explicit Writer(QVSPTraceRecorder *recorder)
+        : recorder(recorder)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        while (!recorder->stopping.loadAcquire())
+        {
+            recorder->drain();
+            msleep(FLUSH_INTERVAL);
+        }
+        recorder->drain();
+        recorder->file.flush();
+    }
+};
+
+/*!
+ * \brief QVSPTraceRecorder::QVSPTraceRecorder Creates a binary link trace
+ * recorder
+ * \param path trace file, overwritten by open()
+ *
+ * Events are serialised by record() into an in-memory ring, which a writer
+ * thread drains to the file every 10 ms. The ring is single producer, single
+ * consumer and lock-free: record() never blocks and costs a timestamp and a
+ * copy of the event data. If the ring is full, the event is dropped and
+ * counted in dropped().
+ *
+ * The file starts with a 24 byte header: "VSPTRACE", the format version and
+ * the record header size (16 bit each), 4 reserved bytes and the wall clock
+ * time of timestamp 0 in ms since epoch (64 bit). Every record consists of
+ * a monotonic timestamp in ns (64 bit), the Event, its argument (8 bit each),
+ * the data length (16 bit) and the data. All integers are little endian.
+ */
+QVSPTraceRecorder::QVSPTraceRecorder(const QString &path)
+    : file(path)
+{
+}
+
+QVSPTraceRecorder::~QVSPTraceRecorder()
+{
+    close();
+}
+
+/*!
+ * \brief QVSPTraceRecorder::open Creates the trace file and starts the writer
+ * thread
+ * \param bufferSize ring capacity, rounded up to a power of two (4 KiB .. 1 GiB)
+ * \return false if the file cannot be created
+ */
+bool QVSPTraceRecorder::open(int bufferSize)
+{
+    if (isOpen() || !file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    quint32 capacity = 4096;
+    while (capacity < quint32(qBound(4096, bufferSize, 1 << 30)))
+        capacity <<= 1;
+    ring.fill(0, int(capacity));
+    buffer = reinterpret_cast<uchar *>(ring.data());
+    mask = capacity - 1;
+    head.store(0);
+    tail.store(0);
+    _dropped.store(0);
+    stopping.store(0);
+
+    clock.start();
+    uchar header[FILE_HEADER_SIZE] = {};
+    memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    qToLittleEndian<quint16>(VERSION, header + 8);
+    qToLittleEndian<quint16>(RECORD_HEADER_SIZE, header + 10);
+    qToLittleEndian<quint64>(quint64(QDateTime::currentMSecsSinceEpoch()), header + 16);
+    file.write(reinterpret_cast<const char *>(header), FILE_HEADER_SIZE);
+
+    writer.reset(new Writer(this));
+    writer->start();
+    return true;
+}
+
+/*!
+ * \brief QVSPTraceRecorder::close Writes the pending events and closes the
+ * trace file
+ */
+void QVSPTraceRecorder::close()
+{
+    if (!isOpen())
+        return;
+
+    buffer = nullptr; // stop recording, the ring stays allocated for the writer
+    stopping.storeRelease(1);
+    writer->wait();
+    writer.reset();
+    file.close();
+}
+
+bool QVSPTraceRecorder::isOpen() const
+{
+    return file.isOpen();
+}
+
+/*!
+ * \brief QVSPTraceRecorder::record Records an event
+ * \param event event type
+ * \param arg event argument
+ * \param data event data, truncated to 65535 byte
+ * \param len data length
+ *
+ * Must always be called from the same thread.
+ */
+void QVSPTraceRecorder::record(Event event, quint8 arg, const char *data, int len)
+{
+    if (buffer == nullptr)
+        return;
+
+    len = qBound(0, len, MAX_RECORD_DATA);
+    const quint32 size = quint32(RECORD_HEADER_SIZE + len);
+    const quint32 h = head.load();
+    if (mask + 1 - (h - tail.loadAcquire()) < size)
+    {
+        _dropped.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    uchar header[RECORD_HEADER_SIZE];
+    qToLittleEndian<quint64>(quint64(clock.nsecsElapsed()), header);
+    header[8] = uchar(event);
+    header[9] = arg;
+    qToLittleEndian<quint16>(quint16(len), header + 10);
+
+    auto put = [this](quint32 pos, const void *src, quint32 n) {
+        const quint32 offset = pos & mask;
+        const quint32 first = qMin(n, mask + 1 - offset);
+        memcpy(buffer + offset, src, first);
+        memcpy(buffer, static_cast<const uchar *>(src) + first, n - first);
+    };
+    put(h, header, RECORD_HEADER_SIZE);
+    if (len > 0)
+        put(h + RECORD_HEADER_SIZE, data, quint32(len));
+
+    head.storeRelease(h + size); // publish
+}
+
+/*!
+ * \brief QVSPTraceRecorder::drain Writes the published events to the file,
+ * called by the writer thread
+ */
+void QVSPTraceRecorder::drain()
+{
+    const quint32 h = head.loadAcquire();
+    const quint32 t = tail.load();
+    if (h == t)
+        return;
+
+    const char *data = ring.constData();
+    const quint32 n = h - t;
+    const quint32 offset = t & mask;
+    const quint32 first = qMin(n, mask + 1 - offset);
+    file.write(data + offset, first);
+    if (n > first)
+        file.write(data, n - first);
+
+    tail.storeRelease(h); // release the space
+}
+
+/*!
+ * \brief QVSPTraceRecorder::dropped Returns the number of events dropped
+ * because the ring was full
+ */
+quint32 QVSPTraceRecorder::dropped() const
+{
+    return _dropped.load();
+}
+
+QString QVSPTraceRecorder::errorString() const
+{
+    return file.errorString();
+}
+
+} // namespace
@@ -0,0 +1,104 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPTRACE_H
+#define QVSPTRACE_H
+
+#include "qvspsocket_global.h"
+#include <QAtomicInteger>
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPTraceRecorder
+{
+public:
+    enum class Event : quint8
+    {
+        CharacteristicWrite = 1, // arg: Characteristic, data: value
+        Notification,            // arg: Characteristic, data: value
+        DescriptorWrite,         // arg: Characteristic of the descriptor, data: value
+        Cts,                     // arg: 1 set, 0 clear
+        Rts,                     // arg: 1 set, 0 clear (confirmed by the device)
+        StateChange,             // arg: QBluetoothSocket::SocketState
+        CharacteristicWritten    // arg: Characteristic, data: value acknowledged by the device
+    };
+
+    enum class Characteristic : quint8
+    {
+        RxFifo,
+        TxFifo,
+        ModemIn,
+        ModemOut,
+        BrspMode
+    };
+
+    static const quint16 VERSION = 1;
+    static const int FILE_HEADER_SIZE = 24;
+    static const int RECORD_HEADER_SIZE = 12;
+
+private:
+    class Writer;
+
+    QFile file;
+    QScopedPointer<Writer> writer;
+    QElapsedTimer clock;
+
+    QByteArray ring;
+    uchar *buffer = nullptr;
+    quint32 mask = 0;
+    QAtomicInteger<quint32> head; // written by the recording thread only
+    QAtomicInteger<quint32> tail; // written by the writer thread only
+    QAtomicInteger<quint32> _dropped;
+    QAtomicInteger<int> stopping;
+
+    void drain();
+
+public:
+    explicit QVSPTraceRecorder(const QString &path);
+    ~QVSPTraceRecorder();
+
+    bool open(int bufferSize = 1 << 20);
+    void close();
+    bool isOpen() const;
+
+    void record(Event event, quint8 arg, const char *data = nullptr, int len = 0);
+
+    quint32 dropped() const;
+    QString errorString() const;
+};
+
+} // namespace
+
+#endif // QVSPTRACE_H
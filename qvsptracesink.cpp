@@ -0,0 +1,225 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvsptracesink.h"
+#include <QCoreApplication>
+#include <QThread>
+
+namespace MiVSP
+{
+
+/*!
+ * \brief QVSPTraceSink::QVSPTraceSink Creates a trace sink and starts its clock
+ *
+ * A sink receives timeline events of one or more sockets. Applications may
+ * feed their own spans into the same sink, stamped with timestamp(), to see
+ * them next to the link activity.
+ */
+QVSPTraceSink::QVSPTraceSink()
+{
+    clock.start();
+}
+
+QVSPTraceSink::~QVSPTraceSink()
+{
+}
+
+/*!
+ * \brief QVSPTraceSink::timestamp Returns the current time of the sink clock
+ * \return monotonic time in ns since the sink has been created
+ */
+qint64 QVSPTraceSink::timestamp() const
+{
+    return clock.nsecsElapsed();
+}
+
+/*!
+ * \fn QVSPTraceSink::event Receives an event
+ * \param phase event phase
+ * \param category comma separated categories, a string literal
+ * \param name event name, a string literal
+ * \param timestamp ns on the sink clock
+ * \param duration ns, for Phase::Complete
+ * \param argName name of the optional argument, nullptr if none
+ * \param argValue argument value
+ * \param source object the event belongs to, e.g. the emitting socket, nullptr
+ * for the calling thread
+ *
+ * Called from the thread of the socket emitting the event, a sink shared by
+ * sockets in different threads has to be thread-safe.
+ */
+
+/*!
+ * \brief QVSPChromeTraceSink::QVSPChromeTraceSink Creates a sink writing
+ * Chrome trace-event JSON
+ * \param path output file, overwritten by open()
+ *
+ * The file uses the JSON array format and can be loaded into
+ * chrome://tracing or Perfetto. It stays loadable if the application ends
+ * without close(), as the closing bracket is optional. The sink may be shared
+ * by sockets in different threads, every socket gets its own track.
+ */
+QVSPChromeTraceSink::QVSPChromeTraceSink(const QString &path)
+    : file(path)
+{
+}
+
+QVSPChromeTraceSink::~QVSPChromeTraceSink()
+{
+    close();
+}
+
+bool QVSPChromeTraceSink::open()
+{
+    close();
+
+    QMutexLocker locker(&mutex);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        _errorString = file.errorString();
+        return false;
+    }
+
+    pid = QCoreApplication::applicationPid();
+    first = true;
+    _errorString.clear();
+    return true;
+}
+
+void QVSPChromeTraceSink::close()
+{
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen())
+        return;
+
+    file.write(first ? "[]\n" : "\n]\n");
+    file.close();
+}
+
+bool QVSPChromeTraceSink::isOpen() const
+{
+    QMutexLocker locker(&mutex);
+    return file.isOpen();
+}
+
+// appends a JSON string literal
+static void appendString(QByteArray &out, const char *s)
+{
+    out.append('"');
+    for (; *s != '\0'; ++s)
+    {
+        const uchar c = uchar(*s);
+        if (c == '"' || c == '\\')
+            out.append('\\').append(char(c));
+        else if (c < 0x20)
+            out.append("\\u00").append("0123456789abcdef"[c >> 4]).append("0123456789abcdef"[c & 0xF]);
+        else
+            out.append(char(c));
+    }
+    out.append('"');
+}
+
+// appends ns as us with three decimals
+static void appendMicroseconds(QByteArray &out, qint64 nsecs)
+{
+    if (nsecs < 0)
+    {
+        out.append('-');
+        nsecs = -nsecs;
+    }
+    out.append(QByteArray::number(nsecs / 1000));
+    const int frac = int(nsecs % 1000);
+    const char digits[4] = { '.', char('0' + frac / 100), char('0' + frac / 10 % 10), char('0' + frac % 10) };
+    out.append(digits, 4);
+}
+
+/*!
+ * \brief QVSPChromeTraceSink::event Writes an event as one JSON object
+ *
+ * Events are buffered by QFile; write errors close the file, see
+ * errorString(). Events of a \a source go to a track of their own, its
+ * counters are told apart by their id.
+ */
+void QVSPChromeTraceSink::event(Phase phase, const char *category, const char *name, qint64 timestamp,
+                                qint64 duration, const char *argName, qint64 argValue, const QObject *source)
+{
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen())
+        return;
+
+    line.clear();
+    line.append(first ? "[\n" : ",\n");
+    first = false;
+
+    line.append("{\"name\":");
+    appendString(line, name);
+    line.append(",\"cat\":");
+    appendString(line, category);
+    line.append(",\"ph\":\"").append(char(phase)).append('"');
+    line.append(",\"ts\":");
+    appendMicroseconds(line, timestamp);
+    if (phase == Phase::Complete)
+    {
+        line.append(",\"dur\":");
+        appendMicroseconds(line, duration);
+    }
+    else if (phase == Phase::Instant)
+        line.append(",\"s\":\"t\"");
+    line.append(",\"pid\":").append(QByteArray::number(pid));
+    const quint64 track = source != nullptr ? quint64(quintptr(source)) : quint64(quintptr(QThread::currentThreadId()));
+    line.append(",\"tid\":").append(QByteArray::number(track & 0xFFFFFFFF));
+    if (source != nullptr && phase == Phase::Counter)
+        line.append(",\"id\":").append(QByteArray::number(track & 0xFFFFFFFF));
+    if (argName != nullptr)
+    {
+        line.append(",\"args\":{");
+        appendString(line, argName);
+        line.append(':').append(QByteArray::number(argValue)).append('}');
+    }
+    line.append('}');
+
+    if (file.write(line) != line.size())
+    {
+        _errorString = file.errorString();
+        file.close();
+    }
+}
+
+QString QVSPChromeTraceSink::errorString() const
+{
+    QMutexLocker locker(&mutex);
+    return _errorString;
+}
+
+} // namespace
@@ -0,0 +1,98 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPTRACESINK_H
+#define QVSPTRACESINK_H
+
+#include "qvspsocket_global.h"
+#include <QMutex>
+
+namespace MiVSP
+{
+
+class QVSPSOCKETSHARED_EXPORT QVSPTraceSink
+{
+public:
+    // Chrome trace-event phases
+    enum class Phase : char
+    {
+        Begin = 'B',
+        End = 'E',
+        Complete = 'X', // with duration
+        Instant = 'i',
+        Counter = 'C'   // argument is the counter value
+    };
+
+private:
+    QElapsedTimer clock;
+
+public:
+    QVSPTraceSink();
+    virtual ~QVSPTraceSink();
+
+    qint64 timestamp() const;
+
+    virtual void event(Phase phase, const char *category, const char *name, qint64 timestamp,
+                       qint64 duration = 0, const char *argName = nullptr, qint64 argValue = 0,
+                       const QObject *source = nullptr) = 0;
+};
+
+class QVSPSOCKETSHARED_EXPORT QVSPChromeTraceSink : public QVSPTraceSink
+{
+private:
+    mutable QMutex mutex; // guards everything below
+    QFile file;
+    QByteArray line;
+    qint64 pid = 0;
+    bool first = true;
+    QString _errorString;
+
+public:
+    explicit QVSPChromeTraceSink(const QString &path);
+    ~QVSPChromeTraceSink() override;
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    void event(Phase phase, const char *category, const char *name, qint64 timestamp,
+               qint64 duration = 0, const char *argName = nullptr, qint64 argValue = 0,
+               const QObject *source = nullptr) override;
+
+    QString errorString() const;
+};
+
+} // namespace
+
+#endif // QVSPTRACESINK_H
@@ -0,0 +1,24 @@
+# Every test builds the library sources in, so that it runs without an
+# installed library.
+
+QT       += bluetooth network testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+DEFINES += QVSPSOCKET_LIBRARY
+DEFINES += QT_NO_CAST_FROM_ASCII QT_NO_CAST_TO_ASCII
+
+INCLUDEPATH += $$PWD/.. $$PWD
+
+SOURCES += $$files($$PWD/../qvsp*.cpp)
+HEADERS += $$files($$PWD/../qvsp*.h)\
+        $$PWD/qvsptesttrace.h
+
+!unix {
+    SOURCES -= $$PWD/../qvspptybridge.cpp
+    HEADERS -= $$PWD/../qvspptybridge.h
+}
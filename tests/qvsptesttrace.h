@@ -0,0 +1,103 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef QVSPTESTTRACE_H
+#define QVSPTESTTRACE_H
+
+#include "qvsptrace.h"
+#include <QVector>
+#include <QtEndian>
+
+namespace MiVSP
+{
+
+struct TestTraceRecord
+{
+    qint64 time; // ns since the first record
+    QVSPTraceRecorder::Event event;
+    quint8 arg;
+    QByteArray data;
+};
+
+// writes a trace in the QVSPTraceRecorder format, with the given timestamps
+inline bool writeTestTrace(const QString &path, const QVector<TestTraceRecord> &records)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    uchar header[QVSPTraceRecorder::FILE_HEADER_SIZE] = {};
+    memcpy(header, "VSPTRACE", 8);
+    qToLittleEndian<quint16>(QVSPTraceRecorder::VERSION, header + 8);
+    qToLittleEndian<quint16>(QVSPTraceRecorder::RECORD_HEADER_SIZE, header + 10);
+    file.write(reinterpret_cast<const char *>(header), QVSPTraceRecorder::FILE_HEADER_SIZE);
+
+    for (const TestTraceRecord &record: records)
+    {
+        uchar recordHeader[QVSPTraceRecorder::RECORD_HEADER_SIZE];
+        qToLittleEndian<quint64>(quint64(record.time), recordHeader);
+        recordHeader[8] = uchar(record.event);
+        recordHeader[9] = record.arg;
+        qToLittleEndian<quint16>(quint16(record.data.size()), recordHeader + 10);
+        file.write(reinterpret_cast<const char *>(recordHeader), QVSPTraceRecorder::RECORD_HEADER_SIZE);
+        file.write(record.data);
+    }
+    return file.error() == QFileDevice::NoError;
+}
+
+// TX FIFO notifications carrying data in chunks of size bytes, interval ns apart
+inline QVector<TestTraceRecord> testNotifications(const QByteArray &data, int size, qint64 start, qint64 interval)
+{
+    QVector<TestTraceRecord> records;
+    for (int pos = 0; pos < data.size(); pos += size)
+    {
+        records.append({ start, QVSPTraceRecorder::Event::Notification,
+                         quint8(QVSPTraceRecorder::Characteristic::TxFifo), data.mid(pos, size) });
+        start += interval;
+    }
+    return records;
+}
+
+// data in which every byte position can be told apart from its neighbours
+inline QByteArray testData(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(i % 251);
+    return data;
+}
+
+} // namespace
+
+#endif // QVSPTESTTRACE_H
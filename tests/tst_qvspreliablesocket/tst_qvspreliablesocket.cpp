@@ -0,0 +1,113 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvspreliablesocket.h"
+#include "qvspreplay.h"
+#include "qvsptesttrace.h"
+#include <QtTest>
+#include <QTemporaryDir>
+
+using namespace MiVSP;
+
+using Event = QVSPTraceRecorder::Event;
+using Characteristic = QVSPTraceRecorder::Characteristic;
+
+static const qint64 MS = 1000000; // ns
+
+class tst_QVSPReliableSocket : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void retransmitLost();
+};
+
+// acknowledgement frame of the peer, with its 2 byte length prefix
+static QByteArray ackFrame(quint16 next, quint32 sack)
+{
+    const char frame[] = {
+        0x00, 0x07, 0x02, char(next >> 8), char(next),
+        char(sack >> 24), char(sack >> 16), char(sack >> 8), char(sack)
+    };
+    return QByteArray(frame, int(sizeof(frame)));
+}
+
+/*!
+ * \brief tst_QVSPReliableSocket::retransmitLost Only the frame the peer lost
+ * is sent again, and the throughput is reported as benchmark result
+ *
+ * The replayed peer misses frame 3 of 16. It reports the gap after 50 ms and
+ * acknowledges the repeated frame after 110 ms, before the retransmission
+ * timeout would send it a third time (~170 ms).
+ */
+void tst_QVSPReliableSocket::retransmitLost()
+{
+    const QVector<TestTraceRecord> records = {
+        { 0, Event::Cts, 1, QByteArray() },
+        { 50 * MS, Event::Notification, quint8(Characteristic::TxFifo), ackFrame(3, 0xFFF) },
+        { 110 * MS, Event::Notification, quint8(Characteristic::TxFifo), ackFrame(16, 0) }
+    };
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("loss.trace"));
+    QVERIFY(writeTestTrace(path, records));
+
+    QVSPReliableSocket socket;
+    QVSPTraceReplay replay(&socket);
+    QVERIFY(replay.load(path));
+    replay.setReplayWrites(false);
+    QSignalSpy acknowledged(&socket, &QVSPReliableSocket::messageAcknowledged);
+    QSignalSpy finished(&replay, &QVSPTraceReplay::finished);
+
+    QVERIFY(replay.start());
+    for (int i = 0; i < 16; ++i)
+        QVERIFY(socket.writeMessage(QByteArray(8, char('a' + i))));
+    QVERIFY(finished.wait(5000));
+
+    QCOMPARE(acknowledged.count(), 16);
+    const QVSPReliableSocket::ReliabilityCounters counters = socket.reliabilityCounters();
+    QCOMPARE(counters.framesSent, quint64(16));
+    QCOMPARE(counters.retransmissions, quint64(1));
+
+    // 2 byte length prefix, 3 byte header and 8 byte payload per frame
+    const QVSPTraceReplay::Report report = replay.report();
+    QCOMPARE(report.errors, quint64(0));
+    QCOMPARE(report.bytesWritten, quint64(17 * 13));
+    QVERIFY(report.replayedDuration >= 110 * MS);
+    QTest::setBenchmarkResult(16 * 8 * 1e9 / double(report.replayedDuration), QTest::BytesPerSecond);
+}
+
+QTEST_MAIN(tst_QVSPReliableSocket)
+
+#include "tst_qvspreliablesocket.moc"
@@ -0,0 +1,5 @@
+include(../qvsptest.pri)
+
+TARGET = tst_qvspreliablesocket
+
+SOURCES += tst_qvspreliablesocket.cpp
@@ -0,0 +1,163 @@
+﻿/*
+ * Qt VSP/BRSP socket implementation on Laird and BlueRadios BT chips (Bluetooth LE)
+ *
+ * Documentation: http://www.lairdtech.com/brandworld/library/Application%20Note%20-%20Using%20VSP%20with%20smartBASIC.pdf
+ *
+ * Copyright (c) 2016 Matthias Dieter Wallnöfer
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Microgate Srl nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "qvsptcpbridge.h"
+#include "qvspreplay.h"
+#include "qvsptesttrace.h"
+#include <QtTest>
+#include <QTemporaryDir>
+
+using namespace MiVSP;
+
+class tst_QVSPTcpBridge : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void fanOut();
+    void backpressure();
+};
+
+/*!
+ * \brief tst_QVSPTcpBridge::fanOut Every client receives all data of the device
+ */
+void tst_QVSPTcpBridge::fanOut()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("fanout.trace"));
+    const QByteArray data = testData(64 * 20);
+    QVERIFY(writeTestTrace(path, testNotifications(data, 20, 0, 1000000)));
+
+    QVSPSocket socket;
+    QVSPTraceReplay replay(&socket);
+    QVERIFY(replay.load(path));
+    replay.setSpeed(0); // recorded order, as fast as possible
+
+    QVSPTcpBridge bridge;
+    const quint16 port = bridge.addSocket(&socket);
+    QVERIFY(port != 0);
+
+    QByteArray received[2];
+    QTcpSocket clients[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        connect(&clients[i], &QIODevice::readyRead, [&received, &clients, i]() {
+            received[i] += clients[i].readAll();
+        });
+        clients[i].connectToHost(QHostAddress::LocalHost, port);
+        QVERIFY(clients[i].waitForConnected(5000));
+    }
+    QTRY_COMPARE(bridge.clientCount(&socket), 2);
+
+    QVERIFY(replay.start());
+    QTRY_COMPARE(received[0].size(), data.size());
+    QTRY_COMPARE(received[1].size(), data.size());
+    QCOMPARE(received[0], data);
+    QCOMPARE(received[1], data);
+    QCOMPARE(replay.report().errors, quint64(0));
+}
+
+/*!
+ * \brief tst_QVSPTcpBridge::backpressure A client not reading clears RTS
+ * instead of losing data, and all clients get everything once it catches up
+ */
+void tst_QVSPTcpBridge::backpressure()
+{
+    // 4 MB within half a second, far more than a stalled TCP connection buffers
+    const int size = 4096;
+    const QByteArray data = testData(1024 * size);
+    QVector<TestTraceRecord> records = testNotifications(data, size, 0, 500000);
+    // keeps the replay from closing the socket while the bridge drains it
+    records.append({ qint64(60) * 1000000000, QVSPTraceRecorder::Event::Notification,
+                     quint8(QVSPTraceRecorder::Characteristic::ModemOut), QByteArray(1, 0x01) });
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("backpressure.trace"));
+    QVERIFY(writeTestTrace(path, records));
+
+    QVSPSocket socket;
+    socket.setReadBufferLimit(16 << 20); // the replayed device ignores RTS
+    QVSPTraceReplay replay(&socket);
+    QVERIFY(replay.load(path));
+
+    QVSPTcpBridge bridge;
+    const quint16 port = bridge.addSocket(&socket);
+    QVERIFY(port != 0);
+
+    QByteArray fastReceived;
+    QByteArray slowReceived;
+    QTcpSocket fast;
+    QTcpSocket slow;
+    connect(&fast, &QIODevice::readyRead, [&]() {
+        fastReceived += fast.readAll();
+    });
+    slow.setReadBufferSize(size); // stops taking data from the kernel once full
+    fast.connectToHost(QHostAddress::LocalHost, port);
+    slow.connectToHost(QHostAddress::LocalHost, port);
+    QVERIFY(fast.waitForConnected(5000));
+    QVERIFY(slow.waitForConnected(5000));
+    QTRY_COMPARE(bridge.clientCount(&socket), 2);
+
+    bool cleared = false;
+    bool resumed = false;
+    connect(&socket, &QVSPSocket::requestToSendChanged, [&](bool set) {
+        if (!set)
+            cleared = true;
+        else if (cleared)
+            resumed = true;
+    });
+
+    QVERIFY(replay.start());
+    QTRY_VERIFY_WITH_TIMEOUT(cleared, 10000); // held back by the slow client
+    QVERIFY(fastReceived.size() < data.size()); // the fast client waits as well
+
+    connect(&slow, &QIODevice::readyRead, [&]() {
+        slowReceived += slow.readAll();
+    });
+    slow.setReadBufferSize(0);
+    slowReceived += slow.readAll();
+
+    QTRY_COMPARE_WITH_TIMEOUT(slowReceived.size(), data.size(), 30000);
+    QTRY_COMPARE_WITH_TIMEOUT(fastReceived.size(), data.size(), 30000);
+    QCOMPARE(slowReceived, data);
+    QCOMPARE(fastReceived, data);
+    QTRY_VERIFY(resumed);
+    QCOMPARE(socket.statistics().readOverflows, quint64(0));
+}
+
+QTEST_MAIN(tst_QVSPTcpBridge)
+
+#include "tst_qvsptcpbridge.moc"
@@ -0,0 +1,5 @@
+include(../qvsptest.pri)
+
+TARGET = tst_qvsptcpbridge
+
+SOURCES += tst_qvsptcpbridge.cpp